@@ -0,0 +1,375 @@
+//
+// benchFault.cpp
+//
+// Fault-injection harness. Runs a sustained open-loop load through
+// ProcessQueue and makes children fail at a configurable rate:
+//   crash    - child dies with SIGSEGV in the middle of a request
+//   hang     - child never returns from a request
+//   exit     - child exits with a failure (ProcessPool::Exit(false))
+//   lockkill - child is SIGKILLed while it holds the Request Queue lock
+// For every fault type it reports lost requests, time for the parent to
+// detect the fault, time to get the worker back (-1 if it never happens),
+// and the throughput dip and recovery. Every scenario prints one JSON
+// object per line; pool error messages go to stderr.
+//
+// Usage: benchFault [-c children] [-f fault,...] [-r requestsPerSec] [-w serviceMicroseconds]
+//                   [-e faultsPerSec] [-t secondsPerScenario] [-o file]
+//
+#include <stdio.h>          // fprintf()
+#include <stdlib.h>         // atoi(), atof()
+#include <string.h>         // strcmp(), strtok()
+#include <signal.h>         // kill(), raise()
+#include <unistd.h>         // getopt(), usleep(), pause()
+#include <sys/mman.h>       // mmap()
+#include <algorithm>        // std::sort()
+#include <string>           // std::string
+#include <vector>           // std::vector
+#include "processQueue.hpp"
+#include "benchUtil.hpp"
+
+enum class FAULT : char
+{
+    NONE=0,
+    CRASH,
+    HANG,
+    EXIT,
+    LOCK_KILL
+};
+
+struct Request
+{
+    uint64_t serviceNs{0};
+    FAULT fault{FAULT::NONE};
+    unsigned int faultIndex{0};
+};
+
+struct BenchOptions
+{
+    int children{4};
+    std::vector<std::string> faults{"crash", "hang", "exit", "lockkill"};
+    double rate{2000};              // Requests per second
+    uint64_t serviceNs{200000};     // 200 us
+    double faultsPerSec{0.5};
+    double secondsPerScenario{6.0};
+    FILE* output{stdout};
+};
+
+// Results shared by children with the parent
+static const unsigned int MAX_FAULTS = 256;
+static const unsigned int MAX_BUCKETS = 1024;
+static const uint64_t BUCKET_NS = 100000000;    // Throughput per 100 ms
+
+struct Shared
+{
+    uint64_t startNs{0};
+    uint64_t completed{0};
+    uint64_t buckets[MAX_BUCKETS]{};    // Completed requests per BUCKET_NS
+    uint64_t faultNs[MAX_FAULTS]{};     // Time the child injected the fault
+    pid_t hungPids[MAX_FAULTS]{};       // Children to kill at the end
+};
+
+static Shared* gShared = nullptr;
+
+//
+// Queue that exposes children state to the harness
+//
+class FaultQueue : public ProcessQueue<Request>
+{
+public:
+    FaultQueue(unsigned int maxRequestCount) : ProcessQueue<Request>(maxRequestCount) {}
+
+    // Children the parent still considers running
+    int GetRunningCount() const
+    {
+        int count = 0;
+        for(const ChildPID& child : mChildrenPIDs)
+            count += (child.status == CHILD_STATUS::RUNNING ? 1 : 0);
+        return count;
+    }
+
+    void Poll() { PollChildren(); }
+
+    // Kill the calling child while it holds the Request Queue lock
+    void KillWhileLocked()
+    {
+        assert(IsChild());
+        QueueLock lock(GetQueueLock(0));
+        kill(getpid(), SIGKILL);
+    }
+
+protected:
+    // Keep JSON output clean
+    void OnError(const std::string& msg) const override { fprintf(stderr, "%s\n", msg.c_str()); }
+};
+
+static FaultQueue* gQueue = nullptr;
+
+void Handler(const Request& request)
+{
+    if(request.fault != FAULT::NONE)
+    {
+        __atomic_store_n(&gShared->faultNs[request.faultIndex], GetMonotonicTimeNs(), __ATOMIC_RELAXED);
+        switch(request.fault)
+        {
+        case FAULT::CRASH:
+            raise(SIGSEGV);
+            break;
+        case FAULT::HANG:
+            gShared->hungPids[request.faultIndex] = getpid();
+            while(true)
+                pause();
+            break;
+        case FAULT::EXIT:
+            gQueue->Exit(false);
+            break;
+        case FAULT::LOCK_KILL:
+            gQueue->KillWhileLocked();
+            break;
+        default:
+            break;
+        }
+    }
+
+    SpinNs(request.serviceNs);
+
+    uint64_t bucket = (GetMonotonicTimeNs() - gShared->startNs) / BUCKET_NS;
+    if(bucket < MAX_BUCKETS)
+        __atomic_add_fetch(&gShared->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gShared->completed, 1, __ATOMIC_RELAXED);
+}
+
+FAULT GetFault(const std::string& name)
+{
+    if(name == "crash")
+        return FAULT::CRASH;
+    if(name == "hang")
+        return FAULT::HANG;
+    if(name == "exit")
+        return FAULT::EXIT;
+    if(name == "lockkill")
+        return FAULT::LOCK_KILL;
+    return FAULT::NONE;
+}
+
+bool RunScenario(const BenchOptions& options, const std::string& faultName)
+{
+    FAULT fault = GetFault(faultName);
+    if(fault == FAULT::NONE)
+    {
+        fprintf(stderr, "Unknown fault '%s'\n", faultName.c_str());
+        return false;
+    }
+
+    new (gShared) Shared;
+
+    FaultQueue procQueue((unsigned int)(options.rate * options.secondsPerScenario) + 1000);
+    gQueue = &procQueue;
+    if(!procQueue.Create(options.children, Handler))
+    {
+        fprintf(stderr, "ProcessQueue::Create() failed\n");
+        return false;
+    }
+
+    // Inject faults evenly from 20% to 60% of the scenario, so there is a baseline
+    // before the first fault and time to recover after the last one
+    uint64_t durationNs = (uint64_t)(options.secondsPerScenario * 1e9);
+    uint64_t faultStartNs = durationNs / 5;
+    uint64_t faultEndNs = durationNs * 3 / 5;
+    unsigned int faultCount = (unsigned int)(options.faultsPerSec * (faultEndNs - faultStartNs) / 1e9 + 0.5);
+    faultCount = std::max(1U, std::min(faultCount, MAX_FAULTS));
+    uint64_t faultIntervalNs = (faultEndNs - faultStartNs) / faultCount;
+
+    uint64_t startNs = GetMonotonicTimeNs();
+    gShared->startNs = startNs;
+    uint64_t intervalNs = (uint64_t)(1e9 / options.rate);
+    uint64_t posted = 0;
+    uint64_t postFailures = 0;
+    unsigned int injected = 0;
+
+    // Fault detection: the parent stops considering the child running
+    std::vector<uint64_t> detectNs;
+    int runningCount = procQueue.GetRunningCount();
+    uint64_t replacedNs = 0;
+
+    for(uint64_t offsetNs = 0; offsetNs < durationNs; offsetNs += intervalNs)
+    {
+        uint64_t nowNs = GetMonotonicTimeNs();
+        if(startNs + offsetNs > nowNs)
+            usleep((useconds_t)((startNs + offsetNs - nowNs) / 1000));
+        else if(nowNs - startNs > durationNs)
+            break; // Posting itself is stuck (e.g. the queue lock is lost)
+
+        Request request;
+        request.serviceNs = options.serviceNs;
+        if(injected < faultCount && offsetNs >= faultStartNs + injected * faultIntervalNs)
+        {
+            request.fault = fault;
+            request.faultIndex = injected++;
+        }
+
+        if(procQueue.Post(request))
+            posted++;
+        else
+            postFailures++;
+
+        // Note: Post() checks for crashed children
+        int count = procQueue.GetRunningCount();
+        for(; count < runningCount; runningCount--)
+            detectNs.push_back(GetMonotonicTimeNs());
+        if(count > runningCount)
+        {
+            runningCount = count;
+            if(runningCount == options.children && !replacedNs)
+                replacedNs = GetMonotonicTimeNs();
+        }
+    }
+    uint64_t postEndNs = GetMonotonicTimeNs();
+
+    // Let children finish what they can: stop when no progress for a second
+    uint64_t completed = 0;
+    uint64_t progressNs = GetMonotonicTimeNs();
+    while((completed = __atomic_load_n(&gShared->completed, __ATOMIC_RELAXED)) < posted &&
+          GetMonotonicTimeNs() - progressNs < 1000000000ULL)
+    {
+        usleep(10000); // 10 ms
+        procQueue.Poll();
+        if(__atomic_load_n(&gShared->completed, __ATOMIC_RELAXED) != completed)
+            progressNs = GetMonotonicTimeNs();
+    }
+
+    // Time to detect every fault (matched in order)
+    std::vector<double> detectMs;
+    for(size_t i = 0; i < detectNs.size() && i < injected; i++)
+    {
+        if(gShared->faultNs[i] && detectNs[i] > gShared->faultNs[i])
+            detectMs.push_back((detectNs[i] - gShared->faultNs[i]) / 1e6);
+    }
+    std::sort(detectMs.begin(), detectMs.end());
+
+    // Throughput before the first fault vs. after it
+    uint64_t firstFaultNs = (gShared->faultNs[0] ? gShared->faultNs[0] : startNs + faultStartNs);
+    size_t faultBucket = std::min<size_t>((firstFaultNs - startNs) / BUCKET_NS, MAX_BUCKETS);
+    size_t endBucket = std::min<size_t>((postEndNs - startNs) / BUCKET_NS, MAX_BUCKETS);
+    double baseline = 0;
+    size_t baselineBuckets = 0;
+    for(size_t i = 2; i < faultBucket; i++, baselineBuckets++)   // Skip the warm-up
+        baseline += gShared->buckets[i];
+    baseline = (baselineBuckets ? baseline / baselineBuckets : 0);
+
+    uint64_t minBucket = UINT64_MAX;
+    double recoveryMs = -1;
+    for(size_t i = faultBucket; i < endBucket; i++)
+    {
+        minBucket = std::min(minBucket, gShared->buckets[i]);
+        if(recoveryMs < 0 && i > faultBucket && gShared->buckets[i] >= baseline * 0.9)
+            recoveryMs = (i - faultBucket) * BUCKET_NS / 1e6;
+        else if(gShared->buckets[i] < baseline * 0.9)
+            recoveryMs = -1; // Dipped again
+    }
+    if(minBucket == UINT64_MAX)
+        minBucket = 0;
+
+    JsonObject result;
+    result.Add("benchmark", "fault")
+          .Add("fault", faultName)
+          .Add("children", options.children)
+          .Add("targetRate", options.rate)
+          .Add("faultsInjected", (uint64_t)injected)
+          .Add("faultsDetected", (uint64_t)detectMs.size())
+          .Add("detectMedianMs", detectMs.empty() ? -1.0 : detectMs[detectMs.size() / 2])
+          .Add("detectMaxMs", detectMs.empty() ? -1.0 : detectMs.back())
+          .Add("replaceMs", replacedNs ? (replacedNs - firstFaultNs) / 1e6 : -1.0)
+          .Add("runningChildrenAtEnd", procQueue.GetRunningCount())
+          .Add("posted", posted)
+          .Add("postFailures", postFailures)
+          .Add("completed", completed)
+          .Add("lost", posted + postFailures - std::min(posted, completed))
+          .Add("baselineRate", baseline * 1e9 / BUCKET_NS)
+          .Add("minRate", minBucket * 1e9 / BUCKET_NS)
+          .Add("dipPercent", baseline > 0 ? 100.0 * (1.0 - minBucket / baseline) : 0.0)
+          .Add("recoveryMs", recoveryMs);
+    result.Write(options.output);
+
+    // Hung children never get to the end of the request
+    for(unsigned int i = 0; i < injected; i++)
+    {
+        if(gShared->hungPids[i])
+            kill(gShared->hungPids[i], SIGKILL);
+    }
+
+    procQueue.Destroy();
+    gQueue = nullptr;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+
+    int opt = 0;
+    while((opt = getopt(argc, argv, "c:f:r:w:e:t:o:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'c':
+            options.children = atoi(optarg);
+            break;
+        case 'f':
+            options.faults.clear();
+            for(char* name = strtok(optarg, ","); name; name = strtok(nullptr, ","))
+                options.faults.push_back(name);
+            break;
+        case 'r':
+            options.rate = atof(optarg);
+            break;
+        case 'w':
+            options.serviceNs = (uint64_t)(atof(optarg) * 1000);
+            break;
+        case 'e':
+            options.faultsPerSec = atof(optarg);
+            break;
+        case 't':
+            options.secondsPerScenario = atof(optarg);
+            break;
+        case 'o':
+            options.output = fopen(optarg, "w");
+            if(!options.output)
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c children] [-f crash,hang,exit,lockkill] [-r requestsPerSec]"
+                    " [-w serviceMicroseconds] [-e faultsPerSec] [-t secondsPerScenario] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(options.children <= 0)
+        options.children = 1;
+    if(options.rate <= 0)
+        options.rate = 1;
+
+    gShared = (Shared*)::mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(gShared == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    bool result = true;
+    for(const std::string& fault : options.faults)
+    {
+        if(!RunScenario(options, fault))
+        {
+            result = false;
+            break;
+        }
+    }
+
+    if(options.output != stdout)
+        fclose(options.output);
+
+    return (result ? 0 : 1);
+}
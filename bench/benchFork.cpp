@@ -0,0 +1,329 @@
+//
+// benchFork.cpp
+//
+// Startup scalability benchmark: time to fork N children and get the first
+// request served for parent heaps of 1 MB up to 32 GB (limited by available
+// memory), optionally backed by transparent huge pages. Children write into
+// a part of the inherited heap to measure copy-on-write faults. Spawn
+// strategies are compared on the same heap:
+//   pool        - ProcessQueue::Create() and the first requests
+//   fork        - bare fork() + _exit() + waitpid()
+//   vfork       - vfork() + _exit() + waitpid()
+//   posix_spawn - posix_spawn() of /bin/true + waitpid()
+// Every measurement prints one JSON object per line.
+//
+// Usage: benchFork [-c children] [-m maxHeapMB] [-w writePercent] [-H] [-s strategy,...] [-o file]
+//
+#include <stdio.h>          // fprintf()
+#include <stdlib.h>         // atoi(), strtoull()
+#include <string.h>         // memset()
+#include <signal.h>         // signal()
+#include <spawn.h>          // posix_spawn()
+#include <unistd.h>         // fork(), vfork(), getopt()
+#include <sys/mman.h>       // mmap(), madvise()
+#include <sys/wait.h>       // waitpid()
+#include <string>           // std::string
+#include <vector>           // std::vector
+#include "processQueue.hpp"
+#include "benchUtil.hpp"
+
+extern char** environ;
+
+struct Request
+{
+    int childIndex{0};
+};
+
+struct BenchOptions
+{
+    int children{0};
+    uint64_t maxHeapBytes{0};
+    int writePercent{10};       // Part of the heap every child writes into
+    bool useHugePages{false};
+    std::vector<std::string> strategies{"pool", "fork", "vfork", "posix_spawn"};
+    FILE* output{stdout};
+};
+
+// Inflated parent heap inherited by children
+static unsigned char* gHeap = nullptr;
+static size_t gHeapSize = 0;
+static size_t gWriteSize = 0;
+
+// Time the first request was picked up by a child (shared memory)
+static uint64_t* gFirstServedNs = nullptr;
+
+// Write into the inherited heap to break copy-on-write sharing
+void TouchHeap(size_t writeSize)
+{
+    const size_t PAGE_SIZE = 4096;
+    for(size_t offset = 0; offset < writeSize; offset += PAGE_SIZE)
+        gHeap[offset]++;
+}
+
+void Handler(const Request& /*request*/)
+{
+    // Note: Measure when a child is ready to serve, not how long it takes to write
+    uint64_t zero = 0;
+    __atomic_compare_exchange_n(gFirstServedNs, &zero, GetMonotonicTimeNs(), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    TouchHeap(gWriteSize);
+}
+
+// Get the available memory from /proc/meminfo
+uint64_t GetAvailableMemory()
+{
+    FILE* file = fopen("/proc/meminfo", "r");
+    if(!file)
+        return 0;
+
+    char line[256]{};
+    uint64_t availableKb = 0;
+    while(fgets(line, sizeof(line), file))
+    {
+        if(strncmp(line, "MemAvailable:", 13) == 0)
+        {
+            availableKb = strtoull(line + 13, nullptr, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return availableKb * 1024;
+}
+
+uint64_t GetMinorFaults()
+{
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+bool CreateHeap(size_t size, bool useHugePages)
+{
+    void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        perror("mmap");
+        return false;
+    }
+
+    if(useHugePages && madvise(addr, size, MADV_HUGEPAGE) < 0)
+        perror("madvise(MADV_HUGEPAGE)");
+
+    // Make the whole heap resident like a real parent's data
+    memset(addr, 1, size);
+
+    gHeap = (unsigned char*)addr;
+    gHeapSize = size;
+    return true;
+}
+
+void DeleteHeap()
+{
+    if(gHeap)
+        munmap(gHeap, gHeapSize);
+    gHeap = nullptr;
+    gHeapSize = 0;
+}
+
+JsonObject StartResult(const BenchOptions& options, const char* strategy)
+{
+    JsonObject result;
+    result.Add("benchmark", "fork")
+          .Add("strategy", strategy)
+          .Add("children", options.children)
+          .Add("heapMB", (uint64_t)(gHeapSize >> 20))
+          .Add("hugePages", options.useHugePages);
+    return result;
+}
+
+bool RunPool(const BenchOptions& options)
+{
+    ProcessQueue<Request> procQueue(options.children);
+    procQueue.EnablePerfCounters();
+    *gFirstServedNs = 0;
+
+    uint64_t parentFaults = GetMinorFaults();
+    uint64_t startNs = GetMonotonicTimeNs();
+    if(!procQueue.Create(options.children, Handler))
+    {
+        fprintf(stderr, "ProcessQueue::Create() failed\n");
+        return false;
+    }
+    uint64_t forkNs = GetMonotonicTimeNs() - startNs;
+    uint64_t forkFaults = GetMinorFaults() - parentFaults;
+
+    for(int i = 0; i < options.children; i++)
+        procQueue.Post(Request{i});
+    procQueue.WaitForCompletion();
+    uint64_t completionNs = GetMonotonicTimeNs() - startNs;
+
+    // The parent writing into its heap after fork pays for copy-on-write too
+    parentFaults = GetMinorFaults();
+    uint64_t touchStartNs = GetMonotonicTimeNs();
+    TouchHeap(gWriteSize);
+    uint64_t parentTouchNs = GetMonotonicTimeNs() - touchStartNs;
+    parentFaults = GetMinorFaults() - parentFaults;
+
+    ProcessQueueStats stats;
+    procQueue.Snapshot(stats);
+
+    JsonObject result = StartResult(options, "pool");
+    result.Add("forkMs", forkNs / 1e6)
+          .Add("forkPerChildUs", forkNs / 1e3 / options.children)
+          .Add("firstRequestMs", (*gFirstServedNs ? (*gFirstServedNs - startNs) / 1e6 : 0.0))
+          .Add("allRequestsMs", completionNs / 1e6)
+          .Add("writeMB", (uint64_t)(gWriteSize >> 20))
+          .Add("parentForkFaults", forkFaults)
+          .Add("parentCowFaults", parentFaults)
+          .Add("parentCowMs", parentTouchNs / 1e6)
+          .Add("childrenPageFaults", stats.total.pageFaults);
+    result.Write(options.output);
+
+    procQueue.Destroy();
+    return true;
+}
+
+// Bare spawn of children that exit right away
+bool RunSpawn(const BenchOptions& options, const std::string& strategy)
+{
+    // Note: The pool ignores SIGCHLD, so restore it to be able to wait
+    signal(SIGCHLD, SIG_DFL);
+
+    std::vector<pid_t> pids;
+    uint64_t startNs = GetMonotonicTimeNs();
+
+    for(int i = 0; i < options.children; i++)
+    {
+        pid_t pid = -1;
+        if(strategy == "fork")
+        {
+            pid = fork();
+            if(pid == 0)
+                _exit(0);
+        }
+        else if(strategy == "vfork")
+        {
+            pid = vfork();
+            if(pid == 0)
+                _exit(0);
+        }
+        else
+        {
+            char path[] = "/bin/true";
+            char* argv[] = {path, nullptr};
+            if(posix_spawn(&pid, path, nullptr, nullptr, argv, environ) != 0)
+                pid = -1;
+        }
+
+        if(pid < 0)
+        {
+            perror(strategy.c_str());
+            break;
+        }
+        pids.push_back(pid);
+    }
+    uint64_t forkNs = GetMonotonicTimeNs() - startNs;
+
+    for(pid_t pid : pids)
+        waitpid(pid, nullptr, 0);
+    uint64_t exitNs = GetMonotonicTimeNs() - startNs;
+
+    JsonObject result = StartResult(options, strategy.c_str());
+    result.Add("forkMs", forkNs / 1e6)
+          .Add("forkPerChildUs", (pids.empty() ? 0.0 : forkNs / 1e3 / pids.size()))
+          .Add("allExitedMs", exitNs / 1e6)
+          .Add("spawned", (uint64_t)pids.size());
+    result.Write(options.output);
+
+    return ((int)pids.size() == options.children);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    options.children = GetCpuCount();
+    options.maxHeapBytes = GetAvailableMemory() / 2;
+
+    int opt = 0;
+    while((opt = getopt(argc, argv, "c:m:w:Hs:o:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'c':
+            options.children = atoi(optarg);
+            break;
+        case 'm':
+            options.maxHeapBytes = strtoull(optarg, nullptr, 10) << 20;
+            break;
+        case 'w':
+            options.writePercent = atoi(optarg);
+            break;
+        case 'H':
+            options.useHugePages = true;
+            break;
+        case 's':
+            options.strategies.clear();
+            for(char* name = strtok(optarg, ","); name; name = strtok(nullptr, ","))
+                options.strategies.push_back(name);
+            break;
+        case 'o':
+            options.output = fopen(optarg, "w");
+            if(!options.output)
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c children] [-m maxHeapMB] [-w writePercent] [-H]"
+                    " [-s pool,fork,vfork,posix_spawn] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(options.children <= 0)
+        options.children = 1;
+
+    gFirstServedNs = (uint64_t*)::mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(gFirstServedNs == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    bool result = true;
+    for(uint64_t heapSize = 1ULL << 20; heapSize <= (32ULL << 30) && result; heapSize *= 4)
+    {
+        if(heapSize > options.maxHeapBytes)
+        {
+            fprintf(stderr, "Skipping %llu MB heap and above: not enough memory (see -m)\n",
+                    (unsigned long long)(heapSize >> 20));
+            break;
+        }
+
+        if(!CreateHeap(heapSize, options.useHugePages))
+            break;
+        gWriteSize = heapSize / 100 * options.writePercent;
+
+        for(const std::string& strategy : options.strategies)
+        {
+            if(strategy == "pool")
+                result = RunPool(options);
+            else if(strategy == "fork" || strategy == "vfork" || strategy == "posix_spawn")
+                result = RunSpawn(options, strategy);
+            else
+                fprintf(stderr, "Unknown spawn strategy '%s'\n", strategy.c_str());
+
+            if(!result)
+                break;
+        }
+
+        DeleteHeap();
+    }
+
+    if(options.output != stdout)
+        fclose(options.output);
+
+    return (result ? 0 : 1);
+}
@@ -0,0 +1,247 @@
+//
+// benchLatency.cpp
+//
+// Open-loop ProcessQueue latency benchmark. The parent posts requests at
+// a fixed target rate (Poisson or constant arrivals) no matter how fast
+// children are, and every request carries the time it was supposed to be
+// posted. Latency is measured from that intended time, so a stalled parent
+// or a full queue shows up in the results instead of slowing down the load
+// (no coordinated omission). The target rate is swept to get the
+// latency-vs-throughput curve. With -s the queue sheds requests once the
+// queue wait stays above the target (see ProcessQueue::SetShedding()).
+// Every step prints one JSON object per line.
+//
+// Usage: benchLatency [-c children] [-w serviceMicroseconds] [-d poisson|constant]
+//                     [-r rate,rate,...] [-t secondsPerStep] [-s shedTargetMs] [-o file]
+//
+#include <stdio.h>          // fprintf()
+#include <stdlib.h>         // atoi(), atof(), strtod()
+#include <string.h>         // strcmp()
+#include <unistd.h>         // getopt(), usleep()
+#include <sys/mman.h>       // mmap()
+#include <random>           // std::mt19937_64
+#include <vector>           // std::vector
+#include "processQueue.hpp"
+#include "benchUtil.hpp"
+
+struct Request
+{
+    uint64_t intendedNs{0};     // Monotonic time the request was scheduled to be posted
+    uint64_t serviceNs{0};      // Time to burn in the handler
+};
+
+struct BenchOptions
+{
+    int children{0};
+    uint64_t serviceNs{50000};  // 50 us
+    bool isPoisson{true};
+    std::vector<double> rates;  // Requests per second
+    double secondsPerStep{2.0};
+    int shedTargetMs{0};        // Shedding is disabled by default
+    FILE* output{stdout};
+};
+
+// Per child histograms of latency from the intended post time (shared memory)
+static LatencyHistogram* gLatency = nullptr;
+static ProcessQueue<Request>* gQueue = nullptr;
+
+void Handler(const Request& request)
+{
+    SpinNs(request.serviceNs);
+    gLatency[gQueue->GetChildIndex()].Record(GetMonotonicTimeNs() - request.intendedNs);
+}
+
+void PrintPercentiles(JsonObject& result, const char* prefix, const LatencyHistogram& histogram)
+{
+    static const struct { const char* name; double percentile; } percentiles[] =
+    {
+        { "P50Us", 50.0 }, { "P90Us", 90.0 }, { "P99Us", 99.0 }, { "P999Us", 99.9 }
+    };
+
+    for(const auto& p : percentiles)
+        result.Add((std::string(prefix) + p.name).c_str(), histogram.GetPercentile(p.percentile) / 1e3);
+    result.Add((std::string(prefix) + "MeanUs").c_str(), histogram.GetMeanNs() / 1e3);
+    result.Add((std::string(prefix) + "MaxUs").c_str(), histogram.maxNs / 1e3);
+}
+
+bool RunStep(const BenchOptions& options, double rate, std::mt19937_64& random)
+{
+    // Room for the whole step in case children can't keep up at all
+    unsigned int maxRequestCount = (unsigned int)(rate * options.secondsPerStep) + 1000;
+
+    size_t latencySize = sizeof(LatencyHistogram) * options.children;
+    void* addr = ::mmap(nullptr, latencySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        perror("mmap");
+        return false;
+    }
+
+    gLatency = (LatencyHistogram*)addr;
+    for(int i = 0; i < options.children; i++)
+        new (&gLatency[i]) LatencyHistogram;
+
+    ProcessQueue<Request> procQueue(maxRequestCount);
+    procQueue.SetShedding(options.shedTargetMs);
+    gQueue = &procQueue;
+    if(!procQueue.Create(options.children, Handler))
+    {
+        fprintf(stderr, "ProcessQueue::Create() failed\n");
+        munmap(addr, latencySize);
+        return false;
+    }
+
+    std::exponential_distribution<double> poisson(rate);
+    double intervalNs = 1e9 / rate;
+    uint64_t durationNs = (uint64_t)(options.secondsPerStep * 1e9);
+
+    uint64_t startNs = GetMonotonicTimeNs();
+    double offsetNs = 0;    // Intended post time relative to the start
+    uint64_t posted = 0;
+    uint64_t failures = 0;
+    uint64_t shed = 0;
+    uint64_t maxLagNs = 0;  // How far behind the schedule the parent has fallen
+
+    while(offsetNs < durationNs)
+    {
+        // Wait for the scheduled time: sleep if it's far, then spin
+        uint64_t intendedNs = startNs + (uint64_t)offsetNs;
+        uint64_t nowNs = GetMonotonicTimeNs();
+        if(intendedNs > nowNs + 200000)
+            usleep((useconds_t)((intendedNs - nowNs - 100000) / 1000));
+        while((nowNs = GetMonotonicTimeNs()) < intendedNs)
+            ;
+
+        if(nowNs - intendedNs > maxLagNs)
+            maxLagNs = nowNs - intendedNs;
+
+        // Note: If we are late, we post immediately, but the latency is still
+        // counted from the intended time
+        Request request;
+        request.intendedNs = intendedNs;
+        request.serviceNs = options.serviceNs;
+        if(procQueue.Post(request))
+            posted++;
+        else if(procQueue.GetPostStatus() == ProcessQueue<Request>::POST_STATUS::SHED)
+            shed++;
+        else
+            failures++;
+
+        offsetNs += (options.isPoisson ? poisson(random) * 1e9 : intervalNs);
+    }
+
+    uint64_t postEndNs = GetMonotonicTimeNs();
+    procQueue.WaitForCompletion();
+    uint64_t endNs = GetMonotonicTimeNs();
+
+    LatencyHistogram latency;
+    for(int i = 0; i < options.children; i++)
+        latency.Add(gLatency[i]);
+
+    ProcessQueueLatency queueLatency;
+    procQueue.GetLatency(queueLatency);
+
+    JsonObject result;
+    result.Add("benchmark", "latency")
+          .Add("children", options.children)
+          .Add("arrivals", options.isPoisson ? "poisson" : "constant")
+          .Add("serviceUs", options.serviceNs / 1e3)
+          .Add("targetRate", rate)
+          .Add("shedTargetMs", options.shedTargetMs)
+          .Add("offeredRate", (posted + shed + failures) / ((postEndNs - startNs) / 1e9))
+          .Add("completedRate", latency.count / ((endNs - startNs) / 1e9))
+          .Add("posted", posted)
+          .Add("postFailures", failures)
+          .Add("shed", shed)
+          .Add("maxPostLagUs", maxLagNs / 1e3);
+    PrintPercentiles(result, "latency", latency);
+    PrintPercentiles(result, "queueWait", queueLatency.queueWait);
+    PrintPercentiles(result, "service", queueLatency.service);
+    result.Write(options.output);
+
+    procQueue.Destroy();
+    gQueue = nullptr;
+    gLatency = nullptr;
+    munmap(addr, latencySize);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    options.children = GetCpuCount();
+
+    int opt = 0;
+    while((opt = getopt(argc, argv, "c:w:d:r:t:s:o:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'c':
+            options.children = atoi(optarg);
+            break;
+        case 'w':
+            options.serviceNs = (uint64_t)(atof(optarg) * 1000);
+            break;
+        case 'd':
+            options.isPoisson = (strcmp(optarg, "constant") != 0);
+            break;
+        case 'r':
+            for(char* next = optarg; *next; )
+            {
+                double rate = strtod(next, &next);
+                if(rate > 0)
+                    options.rates.push_back(rate);
+                if(*next == ',')
+                    next++;
+                else if(*next)
+                    break;
+            }
+            break;
+        case 't':
+            options.secondsPerStep = atof(optarg);
+            break;
+        case 's':
+            options.shedTargetMs = atoi(optarg);
+            break;
+        case 'o':
+            options.output = fopen(optarg, "w");
+            if(!options.output)
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c children] [-w serviceMicroseconds] [-d poisson|constant]"
+                    " [-r rate,rate,...] [-t secondsPerStep] [-s shedTargetMs] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(options.children <= 0)
+        options.children = 1;
+
+    // By default sweep from 10% to 110% of the theoretical capacity
+    if(options.rates.empty())
+    {
+        double capacity = options.children * 1e9 / (options.serviceNs ? options.serviceNs : 1);
+        for(double load : {0.1, 0.25, 0.5, 0.7, 0.8, 0.9, 0.95, 1.0, 1.1})
+            options.rates.push_back(capacity * load);
+    }
+
+    std::mt19937_64 random(12345); // Same arrival times for every build
+    bool result = true;
+    for(double rate : options.rates)
+    {
+        if(!RunStep(options, rate, random))
+        {
+            result = false;
+            break;
+        }
+    }
+
+    if(options.output != stdout)
+        fclose(options.output);
+
+    return (result ? 0 : 1);
+}
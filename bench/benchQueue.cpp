@@ -0,0 +1,191 @@
+//
+// benchQueue.cpp
+//
+// ProcessQueue throughput benchmark: Post()/GetNextRequest()/FreeRequest()
+// with 1..N children, payloads of 16 bytes to 64 KB and empty or heavy
+// request handlers. Every run prints one JSON object per line.
+//
+// Usage: benchQueue [-c maxChildren] [-t secondsPerRun] [-o file]
+//
+#include <stdio.h>          // printf()
+#include <stdlib.h>         // atoi(), atof()
+#include <unistd.h>         // getopt()
+#include <algorithm>        // std::min()
+#include "processQueue.hpp"
+#include "benchUtil.hpp"
+
+// Request payload of SIZE bytes (including the header)
+template<size_t SIZE>
+struct Payload
+{
+    uint64_t seq{0};
+    unsigned char data[SIZE - sizeof(uint64_t)]{};
+};
+
+// Heavy handler reads the whole payload and burns CPU
+const uint64_t HEAVY_HANDLER_NS = 20000; // 20 us
+
+template<class ARGS>
+void EmptyHandler(const ARGS& /*args*/)
+{
+}
+
+template<class ARGS>
+void HeavyHandler(const ARGS& args)
+{
+    volatile unsigned int sum = 0;
+    for(size_t i = 0; i < sizeof(args.data); i += 64)
+        sum = sum + args.data[i];
+    SpinNs(HEAVY_HANDLER_NS);
+}
+
+struct BenchOptions
+{
+    int maxChildren{0};
+    double secondsPerRun{0.5};
+    FILE* output{stdout};
+};
+
+// Run requests through the queue in batches for secondsPerRun and report
+// throughput, lock contention and CPU use
+template<size_t SIZE>
+bool RunQueue(const BenchOptions& options, int children, bool isHeavy)
+{
+    typedef Payload<SIZE> ARGS;
+
+    // Keep up to 64 MB of requests in flight (the queue is in shared memory)
+    const size_t MAX_QUEUE_BYTES = 64 * 1024 * 1024;
+    unsigned int batchSize = (unsigned int)std::min<size_t>(10000, MAX_QUEUE_BYTES / sizeof(ARGS));
+
+    ProcessQueue<ARGS> procQueue(batchSize);
+    procQueue.EnablePerfCounters();
+    if(!procQueue.Create(children, isHeavy ? HeavyHandler<ARGS> : EmptyHandler<ARGS>))
+    {
+        fprintf(stderr, "ProcessQueue::Create() failed\n");
+        return false;
+    }
+
+    // Warm up: fault in the queue nodes and wake up children
+    ARGS args;
+    for(unsigned int i = 0; i < batchSize; i++)
+        procQueue.Post(args);
+    procQueue.WaitForCompletion();
+
+    ProcessQueueStats startStats;
+    procQueue.Snapshot(startStats);
+
+    uint64_t cpuStartNs = GetCpuTimeNs();
+    uint64_t startNs = GetMonotonicTimeNs();
+    uint64_t postNs = 0;
+    uint64_t requests = 0;
+    uint64_t failures = 0;
+    uint64_t elapsedNs = 0;
+
+    do
+    {
+        uint64_t batchStartNs = GetMonotonicTimeNs();
+        for(unsigned int i = 0; i < batchSize; i++)
+        {
+            args.seq = requests++;
+            if(!procQueue.Post(args))
+                failures++;
+        }
+        postNs += GetMonotonicTimeNs() - batchStartNs;
+
+        procQueue.WaitForCompletion();
+        elapsedNs = GetMonotonicTimeNs() - startNs;
+    }
+    while(elapsedNs < options.secondsPerRun * 1e9);
+
+    uint64_t parentCpuNs = GetCpuTimeNs() - cpuStartNs;
+
+    ProcessQueueStats stats;
+    procQueue.Snapshot(stats);
+    stats.Sub(startStats);
+
+    double seconds = elapsedNs / 1e9;
+    uint64_t lockContended = stats.total.lockContended + stats.parent.lockContended;
+    uint64_t lockWaitNs = stats.total.lockWaitNs + stats.parent.lockWaitNs;
+
+    JsonObject result;
+    result.Add("benchmark", "queue")
+          .Add("children", children)
+          .Add("payloadBytes", (uint64_t)SIZE)
+          .Add("handler", isHeavy ? "heavy" : "empty")
+          .Add("requests", requests)
+          .Add("postFailures", failures)
+          .Add("seconds", seconds)
+          .Add("requestsPerSec", requests / seconds)
+          .Add("postsPerSec", (postNs ? requests * 1e9 / postNs : 0.0))
+          .Add("lockContended", lockContended)
+          .Add("lockContendedPerRequest", requests ? (double)lockContended / requests : 0.0)
+          .Add("lockWaitMs", lockWaitNs / 1e6)
+          .Add("lockFailures", stats.total.lockFailures + stats.parent.lockFailures)
+          .Add("childrenBusyMs", stats.total.busyNs / 1e6)
+          .Add("parentCpuMs", parentCpuNs / 1e6)
+          .Add("childrenCpuMs", stats.total.taskClockNs / 1e6)
+          .Add("cpuUtilization", (parentCpuNs + stats.total.taskClockNs) / (double)elapsedNs)
+          .Add("contextSwitches", stats.total.contextSwitches);
+    result.Write(options.output);
+
+    procQueue.Destroy();
+    return true;
+}
+
+template<size_t SIZE>
+bool RunPayload(const BenchOptions& options)
+{
+    // Double the number of children up to (and including) the maximum
+    for(int children = 1; ; children = std::min(children * 2, options.maxChildren))
+    {
+        if(!RunQueue<SIZE>(options, children, false) || !RunQueue<SIZE>(options, children, true))
+            return false;
+
+        if(children == options.maxChildren)
+            return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    options.maxChildren = GetCpuCount();
+
+    int opt = 0;
+    while((opt = getopt(argc, argv, "c:t:o:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'c':
+            options.maxChildren = atoi(optarg);
+            break;
+        case 't':
+            options.secondsPerRun = atof(optarg);
+            break;
+        case 'o':
+            options.output = fopen(optarg, "w");
+            if(!options.output)
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c maxChildren] [-t secondsPerRun] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(options.maxChildren <= 0)
+        options.maxChildren = 1;
+
+    bool result = RunPayload<16>(options) &&
+                  RunPayload<256>(options) &&
+                  RunPayload<4096>(options) &&
+                  RunPayload<65536>(options);
+
+    if(options.output != stdout)
+        fclose(options.output);
+
+    return (result ? 0 : 1);
+}
@@ -0,0 +1,82 @@
+//
+// benchUtil.hpp
+//
+#ifndef _BENCH_UTIL_HPP_
+#define _BENCH_UTIL_HPP_
+
+#include <stdint.h>         // uint64_t
+#include <stdio.h>          // FILE, fprintf()
+#include <sched.h>          // sched_getaffinity()
+#include <unistd.h>         // sysconf()
+#include <sys/resource.h>   // getrusage()
+#include <string>           // std::string
+#include "processStats.hpp"
+
+//
+// Helpers shared by the benchmarks
+//
+
+// CPU (user + system) time of the calling process in nanoseconds
+inline uint64_t GetCpuTimeNs()
+{
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+           ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+// Number of CPUs the benchmark is allowed to run on
+inline int GetCpuCount()
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+        return CPU_COUNT(&cpus);
+
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0 ? (int)count : 1);
+}
+
+// Burn CPU for about ns nanoseconds (simulates a request handler)
+inline void SpinNs(uint64_t ns)
+{
+    uint64_t endNs = GetMonotonicTimeNs() + ns;
+    while(GetMonotonicTimeNs() < endNs)
+        ;
+}
+
+//
+// Minimal JSON writer: one object per line, so the output can be
+// appended to a file and compared between builds with standard tools
+//
+class JsonObject
+{
+public:
+    JsonObject& Add(const char* name, const std::string& value) { return AddRaw(name, "\"" + value + "\""); }
+    JsonObject& Add(const char* name, const char* value) { return Add(name, std::string(value)); }
+    JsonObject& Add(const char* name, double value)
+    {
+        char buf[64]{};
+        snprintf(buf, sizeof(buf), "%.6g", value);
+        return AddRaw(name, buf);
+    }
+    JsonObject& Add(const char* name, uint64_t value) { return AddRaw(name, std::to_string(value)); }
+    JsonObject& Add(const char* name, int value) { return AddRaw(name, std::to_string(value)); }
+    JsonObject& Add(const char* name, bool value) { return AddRaw(name, value ? "true" : "false"); }
+
+    // Add a nested object or an array
+    JsonObject& AddRaw(const char* name, const std::string& json)
+    {
+        mJson += (mJson.empty() ? "" : ",");
+        mJson += "\"" + std::string(name) + "\":" + json;
+        return *this;
+    }
+
+    std::string Str() const { return "{" + mJson + "}"; }
+    void Write(FILE* file) const { fprintf(file, "%s\n", Str().c_str()); fflush(file); }
+
+private:
+    std::string mJson;
+};
+
+#endif // _BENCH_UTIL_HPP_
@@ -2,10 +2,42 @@
 // main.cpp
 //
 #include <iostream>
+#include <fstream>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "processPool.hpp"
 #include "processQueue.hpp"
+#include "processRcu.hpp"
+#include "processSync.hpp"
+#include "processStats.hpp"
+
+// Number of failed checks, main() returns non-zero if there are any
+static int gFailures = 0;
+
+void Check(const char* func, const char* what, bool isPassed)
+{
+    std::cout << ">>> " << func << ": " << what << (isPassed ? " - passed" : " - FAILED") << std::endl;
+    if(!isPassed)
+        gFailures++;
+}
+
+// Create an object in shared memory to collect results of child processes
+template<class T>
+T* CreateShared()
+{
+    void* addr = mmap(nullptr, sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return (addr != MAP_FAILED ? new (addr) T : nullptr);
+}
+
+template<class T>
+void DeleteShared(T* ptr)
+{
+    if(ptr)
+        munmap(ptr, sizeof(T));
+}
 
 void TestProcessPool()
 {
@@ -65,9 +97,15 @@ void TestProcessQueue()
         std::cout << "[pid=" << getpid() << "] Got request: " << args.count << " '" << args.name << "'" << std::endl;
     };
 
+    // This is routine that will be executed by every child process for a broadcast message
+    auto broadcastFptr = [](const Args& args)
+    {
+        std::cout << "[pid=" << getpid() << "] Got broadcast: " << args.count << " '" << args.name << "'" << std::endl;
+    };
+
     // Create process queue
     ProcessQueue<Args> procQueue;
-    if(!procQueue.Create(4, fptr))  // 4 processes
+    if(!procQueue.Create(4, fptr, broadcastFptr))  // 4 processes
     {
         std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
         return;
@@ -95,14 +133,1307 @@ void TestProcessQueue()
     // Wait until all requests completed
     procQueue.WaitForCompletion();
 
+    // Tell every child process to flush its cache
+    procQueue.Broadcast(Args(0, "flush"));
+    procQueue.WaitForBroadcast();
+
+    // Print how requests were spread across child processes
+    ProcessQueueStats stats;
+    if(procQueue.Snapshot(stats))
+    {
+        std::cout << ">>> " << __func__ << ": Posted " << stats.posted << " requests, max queue depth "
+                  << stats.maxQueueDepth << std::endl;
+        for(size_t i = 0; i < stats.children.size(); i++)
+        {
+            std::cout << ">>> " << __func__ << ": Child " << i << " processed " << stats.children[i].requests
+                      << " requests, busy " << stats.children[i].busyNs / 1000 << " us" << std::endl;
+        }
+    }
+
+    // A child killed in the middle of updating its counters doesn't block Snapshot()
+    ProcessStatsSection section;
+    section.BeginUpdate();
+    section.Add(section.stats.requests, 1);
+    ProcessChildStats copy;
+    Check(__func__, "counters of a killed writer are read as they are", !section.Read(copy) && copy.requests == 1);
+
+    // Print latency distribution of all requests
+    ProcessQueueLatency latency;
+    if(procQueue.GetLatency(latency))
+    {
+        std::cout << ">>> " << __func__ << ": End-to-end latency p50 " << latency.endToEnd.GetPercentile(50) / 1000
+                  << " us, p99 " << latency.endToEnd.GetPercentile(99) / 1000
+                  << " us, p99.9 " << latency.endToEnd.GetPercentile(99.9) / 1000 << " us" << std::endl;
+    }
+
     // We are done with Process Queue test
     std::cout << ">>> " << __func__ << ": End of ProcessQueue test part 2" << std::endl;
 }
 
+void TestLatencyHistogram()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of LatencyHistogram test" << std::endl;
+
+    // Values below SUB_BUCKET_COUNT and the first sub-buckets above it are exact
+    bool isExact = true;
+    for(uint64_t value : {0, 31, 32, 33})
+        isExact &= (LatencyHistogram::GetBucketValue(LatencyHistogram::GetBucketIndex(value)) == value);
+    Check(__func__, "small values are exact", isExact);
+
+    // Larger values are rounded up to their bucket by less than 1/SUB_BUCKET_COUNT
+    uint64_t bucket1000 = LatencyHistogram::GetBucketValue(LatencyHistogram::GetBucketIndex(1000));
+    uint64_t big = 1ULL << 40;
+    uint64_t bucketBig = LatencyHistogram::GetBucketValue(LatencyHistogram::GetBucketIndex(big));
+    Check(__func__, "1000 falls into bucket up to 1007", bucket1000 == 1007);
+    Check(__func__, "2^40 falls into bucket up to 2^40 + 2^35 - 1", bucketBig == big + (1ULL << 35) - 1);
+
+    // Values above the maximum exponent go to the last bucket
+    uint64_t huge = 1ULL << (LatencyHistogram::MAX_EXPONENT + 7);
+    Check(__func__, "values above the maximum exponent go to the last bucket",
+          LatencyHistogram::GetBucketIndex(huge) == LatencyHistogram::BUCKET_COUNT - 1);
+
+    // Percentiles of 0, 31, 32, 33, 1000, 2^40 and a value above the maximum exponent
+    LatencyHistogram all;
+    LatencyHistogram low;
+    LatencyHistogram high;
+    const uint64_t values[] = {0, 31, 32, 33, 1000, big, huge};
+    for(uint64_t value : values)
+    {
+        all.Record(value);
+        (value < 33 ? low : high).Record(value);
+    }
+    Check(__func__, "count, min and max", all.count == 7 && all.minNs == 0 && all.maxNs == huge);
+    Check(__func__, "p50 is the 4th value", all.GetPercentile(50) == 33);
+    Check(__func__, "p99 is the largest value", all.GetPercentile(99) == huge);
+    Check(__func__, "p100 is the largest value", all.GetPercentile(100) == huge);
+
+    // Merging histograms of two children gives the same distribution
+    LatencyHistogram merged;
+    merged.Add(low);
+    merged.Add(high);
+    merged.Add(LatencyHistogram());
+    bool isSame = (merged.count == all.count && merged.sumNs == all.sumNs &&
+                   merged.minNs == all.minNs && merged.maxNs == all.maxNs);
+    for(unsigned int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++)
+        isSame &= (merged.buckets[i] == all.buckets[i]);
+    Check(__func__, "Add() merges buckets, count, sum, min and max", isSame);
+    Check(__func__, "percentiles of merged histogram", merged.GetPercentile(50) == 33 &&
+          merged.GetPercentile(99) == huge && merged.GetPercentile(100) == huge);
+
+    std::cout << ">>> " << __func__ << ": End of LatencyHistogram test" << std::endl;
+}
+
+void TestProcessCapture()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessCapture test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    auto fptr = [](const Args& args)
+    {
+        std::cout << "[pid=" << getpid() << "] Got request: " << args.count << std::endl;
+    };
+
+    ProcessQueue<Args> procQueue;
+    procQueue.SetTenantCount(2);
+    if(!procQueue.Create(2, fptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    // Record requests with their timing, tenant, cost and node...
+    const char* path = "/tmp/process_pool_capture.bin";
+    Check(__func__, "ProcessQueue::StartCapture()", procQueue.StartCapture(path));
+    int capturedCount = 0;
+    int capturedTenantCount = 0;
+    for(int i = 0; i < 6; i++)
+    {
+        if(i % 3 == 0)
+            procQueue.Post(Args{i});
+        else if(i % 3 == 1)
+            capturedTenantCount += (procQueue.PostToTenant(Args{i}, 1, 10) ? 1 : 0);
+        else
+            procQueue.PostToNode(Args{i}, 0, 5);
+        capturedCount++;
+        usleep(10000); // 10 ms
+    }
+    procQueue.StopCapture();
+    procQueue.WaitForCompletion();
+
+    // ...and replay them 10 times faster
+    ProcessQueueStats before;
+    ProcessQueueStats after;
+    procQueue.Snapshot(before);
+    Check(__func__, "ProcessQueue::Replay()", procQueue.Replay(path, 10.0));
+    procQueue.Snapshot(after);
+    after.Sub(before);
+    Check(__func__, "every captured request is replayed", after.posted == (uint64_t)capturedCount);
+    Check(__func__, "replayed requests keep their tenant",
+          after.tenants.size() == 2 && after.tenants[1].posted == (uint64_t)capturedTenantCount);
+    unlink(path);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessCapture test" << std::endl;
+}
+
+// Routing table shared by the parent with child processes.
+// Note: Must be a global (or static) to be accessible from the request routine.
+struct Routes
+{
+    int generation{0};
+    char gateway[32]{};
+};
+static ProcessRcu<Routes> gRoutes;
+
+// Routes every request saw (shared with child processes)
+struct RcuSeen
+{
+    int generation[10]{};
+    char gateway[10][32]{};
+};
+static RcuSeen* gRcuSeen = nullptr;
+
+void TestProcessRcu()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessRcu test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    // Children see the version of the routes picked up before this request
+    auto fptr = [](const Args& args)
+    {
+        const Routes& routes = gRoutes.Get();
+        std::cout << "[pid=" << getpid() << "] Got request: " << args.count
+                  << " routes generation " << routes.generation << " '" << routes.gateway << "'" << std::endl;
+        gRcuSeen->generation[args.count] = routes.generation;
+        memcpy(gRcuSeen->gateway[args.count], routes.gateway, sizeof(routes.gateway));
+    };
+
+    Routes routes;
+    routes.generation = 1;
+    strncpy(routes.gateway, "10.0.0.1", sizeof(routes.gateway)-1);
+
+    gRcuSeen = CreateShared<RcuSeen>();
+    ProcessQueue<Args> procQueue;
+    if(!gRcuSeen || !gRoutes.Create(4, routes) || !procQueue.AddRcu(gRoutes) || !procQueue.Create(4, fptr))
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gRcuSeen);
+        return;
+    }
+
+    for(int i = 0; i < 5; i++)
+        procQueue.Post(Args{i});
+    procQueue.WaitForCompletion();
+
+    // Publish new routes without restarting child processes
+    routes.generation = 2;
+    strncpy(routes.gateway, "10.0.0.2", sizeof(routes.gateway)-1);
+    Check(__func__, "ProcessRcu::Publish()", gRoutes.Publish(routes));
+
+    for(int i = 5; i < 10; i++)
+        procQueue.Post(Args{i});
+    procQueue.WaitForCompletion();
+
+    bool isOldSeen = true;
+    bool isNewSeen = true;
+    for(int i = 0; i < 5; i++)
+    {
+        isOldSeen &= (gRcuSeen->generation[i] == 1 && strcmp(gRcuSeen->gateway[i], "10.0.0.1") == 0);
+        isNewSeen &= (gRcuSeen->generation[i+5] == 2 && strcmp(gRcuSeen->gateway[i+5], "10.0.0.2") == 0);
+    }
+    Check(__func__, "requests before Publish() see the first routes", isOldSeen);
+    Check(__func__, "requests after Publish() see the new routes", isNewSeen);
+
+    // Routes have reader slots for 4 children only
+    ProcessQueue<Args> bigQueue;
+    bigQueue.AddRcu(gRoutes);
+    Check(__func__, "more children than readers of shared data is an error", !bigQueue.Create(5, fptr));
+
+    procQueue.Destroy();
+    DeleteShared(gRcuSeen);
+    gRcuSeen = nullptr;
+
+    std::cout << ">>> " << __func__ << ": End of ProcessRcu test" << std::endl;
+}
+
+// Arrivals of every barrier phase and data handed over with the event
+// (shared with child processes)
+struct BarrierRuns
+{
+    int arrived[3]{};
+    int eventData{0};
+};
+
+void TestProcessBarrier()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessBarrier test" << std::endl;
+
+    // Note: Barrier, latch and event must be created before forking child processes
+    ProcessBarrier barrier;
+    ProcessLatch latch;
+    ProcessEvent event;
+    BarrierRuns* runs = CreateShared<BarrierRuns>();
+    if(!runs || !barrier.Create(4) || !latch.Create(4) || !event.Create())
+    {
+        std::cout << ">>> " << __func__ << ": ProcessBarrier::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(runs);
+        return;
+    }
+
+    // Note: Create() is blocked for a parent process until all children exit,
+    // a child that fails any check exits with false and fails Create()
+    ProcessPool procPool;
+    bool isCreated = procPool.Create(4); // 4 processes
+
+    // Run multi-phase computation in the same set of child processes
+    if(procPool.IsChild())
+    {
+        for(int phase = 0; phase < 3; phase++)
+        {
+            usleep((random() % 5) * 1000); // Add a random 0-4 ms delay
+            std::cout << "[" << procPool.GetChildIndex() << "][pid=" << getpid() << "]"
+                    << " Done with phase " << phase << std::endl;
+            __atomic_add_fetch(&runs->arrived[phase], 1, __ATOMIC_RELAXED);
+
+            // Wait for all siblings to complete this phase
+            if(!barrier.Wait(5000 /*5 sec*/) || __atomic_load_n(&runs->arrived[phase], __ATOMIC_RELAXED) != 4)
+                procPool.Exit(false);
+        }
+
+        // Nobody passes the latch before every sibling counts down
+        if(!latch.ArriveAndWait(5000 /*5 sec*/))
+            procPool.Exit(false);
+
+        // The first child hands data over to its siblings with the event
+        if(procPool.GetChildIndex() == 0)
+        {
+            usleep(10000); // 10 ms
+            __atomic_store_n(&runs->eventData, 42, __ATOMIC_RELAXED);
+            event.Set();
+        }
+        else if(!event.Wait(5000 /*5 sec*/) || __atomic_load_n(&runs->eventData, __ATOMIC_RELAXED) != 42)
+        {
+            procPool.Exit(false);
+        }
+
+        procPool.Exit(true);
+    }
+
+    Check(__func__, "children passed the barrier, latch and event", isCreated);
+    Check(__func__, "every child arrived in every phase",
+          runs->arrived[0] == 4 && runs->arrived[1] == 4 && runs->arrived[2] == 4);
+    Check(__func__, "latch is open once counted down", latch.Wait(0));
+    Check(__func__, "event stays set", event.IsSet() && event.Wait(0));
+
+    // Waits time out when nobody arrives or sets the event
+    ProcessLatch closedLatch;
+    Check(__func__, "latch times out", closedLatch.Create(1) && !closedLatch.Wait(10));
+    event.Reset();
+    Check(__func__, "event times out after Reset()", !event.IsSet() && !event.Wait(10));
+
+    DeleteShared(runs);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessBarrier test" << std::endl;
+}
+
+// Number of occurrences of the text in the file
+int CountInFile(const char* path, const std::string& text)
+{
+    std::ifstream file(path);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    int count = 0;
+    for(size_t pos = content.find(text); pos != std::string::npos; pos = content.find(text, pos + text.size()))
+        count++;
+    return count;
+}
+
+void TestProcessTrace()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue trace test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    auto fptr = [](const Args&)
+    {
+        usleep(1000); // 1 ms
+    };
+
+    ProcessQueue<Args> procQueue;
+    if(!procQueue.EnableTracing(1024) || !procQueue.Create(2, fptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    for(int i = 0; i < 10; i++)
+        procQueue.Post(Args{i});
+    procQueue.WaitForCompletion();
+
+    // Open the file in chrome://tracing or ui.perfetto.dev
+    const char* path = "/tmp/process_pool_trace.json";
+    bool isWritten = procQueue.WriteTrace(path);
+    procQueue.Destroy();
+
+    Check(__func__, "trace is written", isWritten && CountInFile(path, "\"traceEvents\"") == 1);
+    Check(__func__, "every request is posted and processed",
+          CountInFile(path, "\"ph\":\"i\",\"name\":\"post\"") == 10 &&
+          CountInFile(path, "\"ph\":\"B\",\"name\":\"request\"") == 10 &&
+          CountInFile(path, "\"ph\":\"E\",\"name\":\"request\"") == 10);
+    Check(__func__, "parent and children are named", CountInFile(path, "\"name\":\"process_name\"") == 3);
+    unlink(path);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue trace test" << std::endl;
+}
+
+void TestProcessProbes()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of USDT probes test" << std::endl;
+
+#ifdef DTRACE_PROBE2
+    // Every probe leaves an ELF note with the provider and probe names in the executable
+    const char* probes[] = {"fork", "wait_for_one", "child_crash", "post", "dequeue",
+                            "request_start", "request_done", "free_request"};
+    bool isFound = true;
+    for(const char* probe : probes)
+    {
+        std::string note = std::string("process_pool") + '\0' + probe + '\0';
+        isFound = isFound && CountInFile("/proc/self/exe", note) > 0;
+    }
+    Check(__func__, "probes are compiled into the executable", isFound);
+#else
+    std::cout << ">>> " << __func__ << ": <sys/sdt.h> is not installed, probes are compiled out" << std::endl;
+#endif
+
+    std::cout << ">>> " << __func__ << ": End of USDT probes test" << std::endl;
+}
+
+void TestProcessPerf()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue perf counters test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    // Every request keeps the CPU busy for 2 ms of its own CPU time (other processes may run meanwhile)
+    auto fptr = [](const Args&)
+    {
+        auto getCpuTimeNs = []()
+        {
+            struct timespec ts{};
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+            return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        };
+
+        uint64_t endNs = getCpuTimeNs() + 2000000;
+        while(getCpuTimeNs() < endNs);
+    };
+
+    ProcessQueue<Args> procQueue;
+    procQueue.EnablePerfCounters();
+    if(!procQueue.Create(2, fptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    for(int i = 0; i < 20; i++)
+        procQueue.Post(Args{i});
+    procQueue.WaitForCompletion();
+
+    // Note: Children publish counters before they tell the parent they are done
+    ProcessQueueStats stats;
+    procQueue.Snapshot(stats);
+    procQueue.Destroy();
+
+    std::cout << ">>> " << __func__ << ": Task clock " << stats.total.taskClockNs / 1000 << " us, "
+              << stats.total.contextSwitches << " context switches, " << stats.total.cycles << " cycles, "
+              << stats.total.instructions << " instructions" << std::endl;
+    Check(__func__, "children CPU time is counted", stats.total.taskClockNs >= 30000000);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue perf counters test" << std::endl;
+}
+
+struct MemoryArgs
+{
+    int megabytes{0};
+};
+
+class MemoryQueue : public ProcessQueue<MemoryArgs>
+{
+public:
+    uint64_t GetPeakPrivate() const { return mPeakPrivate; }
+
+protected:
+    void OnChildMemory(int /*childIndex*/, const ProcessMemoryUsage& usage) override
+    {
+        mPeakPrivate = std::max(mPeakPrivate, usage.GetPrivate());
+    }
+
+private:
+    uint64_t mPeakPrivate = 0;
+};
+
+void TestProcessMemory()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue memory monitor test" << std::endl;
+
+    // Touch every page of the buffer and hold it long enough to be sampled
+    auto fptr = [](const MemoryArgs& args)
+    {
+        size_t size = args.megabytes * 1024UL * 1024UL;
+        char* buffer = static_cast<char*>(malloc(size));
+        memset(buffer, 1, size);
+        usleep(300000); // 300 ms
+        free(buffer);
+    };
+
+    const uint64_t threshold = 16 * 1024 * 1024;
+
+    MemoryQueue procQueue;
+    procQueue.SetMemoryMonitor(10, threshold);  // Sample every 10 ms
+    if(!procQueue.Create(1, fptr))  // 1 process
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    procQueue.Post(MemoryArgs{32});
+    procQueue.WaitForCompletion();
+
+    ProcessMemoryUsage usage;
+    bool isSampled = procQueue.GetChildMemory(0, usage);
+    procQueue.Destroy();
+
+    std::cout << ">>> " << __func__ << ": Peak private memory " << procQueue.GetPeakPrivate() / 1024
+              << " KB, last sample " << usage.GetPrivate() / 1024 << " KB" << std::endl;
+    Check(__func__, "child memory is sampled", isSampled && usage.sampleTimeNs != 0);
+    Check(__func__, "OnChildMemory() is called over the threshold", procQueue.GetPeakPrivate() > threshold);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue memory monitor test" << std::endl;
+}
+
+static int* gTuneCount = nullptr;
+
+void TestProcessTune()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue auto-tuning test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    auto fptr = [](const Args&)
+    {
+        __atomic_add_fetch(gTuneCount, 1, __ATOMIC_RELAXED);
+        usleep(1000); // 1 ms
+    };
+
+    // 100 requests of 1 ms take ~100 ms for a single child
+    std::vector<Args> calibration(100);
+
+    ProcessQueue<Args> procQueue;
+    ProcessTuneResult best;
+    gTuneCount = CreateShared<int>();
+    if(!gTuneCount || !procQueue.Tune(calibration, fptr, best, true, 2))  // Up to 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Tune() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gTuneCount);
+        return;
+    }
+
+    std::cout << ">>> " << __func__ << ": Best of " << procQueue.GetTuneResults().size() << " configurations: "
+              << best.procCount << " children, dequeue batch " << best.dequeueBatch << std::endl;
+    Check(__func__, "configurations are measured", !procQueue.GetTuneResults().empty());
+    Check(__func__, "best configuration is within limits", best.procCount >= 1 && best.procCount <= 2 && best.dequeueBatch >= 1);
+    Check(__func__, "best configuration is applied", procQueue.GetDequeueBatch() == best.dequeueBatch);
+
+    // The queue is created with the best configuration
+    *gTuneCount = 0;
+    for(int i = 0; i < 10; i++)
+        procQueue.Post(Args{i});
+    procQueue.WaitForCompletion();
+    procQueue.Destroy();
+
+    Check(__func__, "tuned queue processes requests", *gTuneCount == 10);
+
+    DeleteShared(gTuneCount);
+    gTuneCount = nullptr;
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue auto-tuning test" << std::endl;
+}
+
+static int* gNumaCount = nullptr;
+
+void TestProcessNuma()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue NUMA test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    auto fptr = [](const Args&)
+    {
+        __atomic_add_fetch(gNumaCount, 1, __ATOMIC_RELAXED);
+    };
+
+    std::vector<ProcessAffinity::Node> nodes = ProcessAffinity::GetNodes();
+    if(nodes.empty())
+    {
+        std::cout << ">>> " << __func__ << ": No NUMA nodes are found, skipped" << std::endl;
+        return;
+    }
+
+    ProcessQueue<Args> procQueue;
+    gNumaCount = CreateShared<int>();
+    if(!gNumaCount || !procQueue.EnableNuma() || !procQueue.Create(2, fptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gNumaCount);
+        return;
+    }
+
+    // Note: Children of other nodes take requests of the first node once their node has none
+    bool isPosted = true;
+    for(int i = 0; i < 10; i++)
+        isPosted = procQueue.PostToNode(Args{i}, nodes[0].node) && isPosted;
+    procQueue.WaitForCompletion();
+
+    // There is no sub-queue of a node past the last one
+    bool isRejected = !procQueue.PostToNode(Args{}, nodes.back().node + 1);
+    procQueue.Destroy();
+
+    std::cout << ">>> " << __func__ << ": " << nodes.size() << " NUMA node(s), " << *gNumaCount
+              << " requests of node " << nodes[0].node << " are processed" << std::endl;
+    Check(__func__, "requests posted to the node are processed", isPosted && *gNumaCount == 10);
+    Check(__func__, "unknown node is rejected", isRejected);
+
+    DeleteShared(gNumaCount);
+    gNumaCount = nullptr;
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue NUMA test" << std::endl;
+}
+
+void TestProcessLimits()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue container limits test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    auto fptr = [](const Args&)
+    {
+        usleep(1000); // 1 ms
+    };
+
+    int cpuCount = ProcessLimits::GetAffinityCpuCount();
+    int cpuLimit = ProcessLimits::GetCpuLimit();
+    uint64_t memoryLimit = ProcessLimits::GetMemoryLimit();
+    std::cout << ">>> " << __func__ << ": " << cpuCount << " CPUs, cgroup CPU limit " << ProcessLimits::GetCgroupCpuLimit()
+              << ", memory limit " << (memoryLimit >> 20) << " MB" << std::endl;
+    Check(__func__, "CPU limit is bounded by the affinity mask", cpuLimit >= 1 && cpuLimit <= cpuCount);
+    Check(__func__, "one child per CPU by default", ProcessLimits::GetProcCount() == cpuLimit);
+    Check(__func__, "children fit into the memory limit", ProcessLimits::GetProcCount(memoryLimit) == 1);
+    Check(__func__, "requests fit into the memory limit",
+          ProcessLimits::GetRequestCount(1024) == std::min<uint64_t>(memoryLimit / ProcessLimits::MEMORY_SHARE / 1024, UINT_MAX));
+
+    // Both the number of children and the queue size come from the limits
+    ProcessQueue<Args> procQueue(ProcessQueue<Args>::AUTO_REQUEST_COUNT);
+    if(!procQueue.Create(ProcessPool::AUTO_PROC_COUNT, fptr))
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    bool isPosted = true;
+    for(int i = 0; i < 100; i++)
+        isPosted = procQueue.Post(Args{i}) && isPosted;
+    procQueue.WaitForCompletion();
+
+    ProcessQueueStats stats;
+    procQueue.Snapshot(stats);
+    procQueue.Destroy();
+
+    std::cout << ">>> " << __func__ << ": " << stats.children.size() << " children processed "
+              << stats.total.requests << " requests" << std::endl;
+    Check(__func__, "AUTO_PROC_COUNT creates a child per CPU", (int)stats.children.size() == cpuLimit);
+    Check(__func__, "AUTO_REQUEST_COUNT queue takes requests", isPosted && stats.total.requests == 100);
+
+    // Zero is still an invalid queue size, not an automatic one
+    ProcessQueue<Args> emptyQueue(0);
+    Check(__func__, "zero-size queue can't be created", !emptyQueue.Create(1, fptr));
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue container limits test" << std::endl;
+}
+
+struct SchedulingArgs
+{
+    int count{0};
+};
+
+struct SchedulingRuns
+{
+    int nice[2]{};
+    int policy[2]{-1, -1};
+};
+static SchedulingRuns* gSchedulingRuns = nullptr;
+static ProcessQueue<SchedulingArgs>* gSchedulingQueue = nullptr;
+
+void TestProcessScheduling()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue scheduling test" << std::endl;
+
+    // Every child records its scheduling
+    auto fptr = [](const SchedulingArgs&) {};
+    auto broadcastFptr = [](const SchedulingArgs&)
+    {
+        int childIndex = gSchedulingQueue->GetChildIndex();
+        gSchedulingRuns->nice[childIndex] = getpriority(PRIO_PROCESS, 0);
+        gSchedulingRuns->policy[childIndex] = sched_getscheduler(0);
+    };
+
+    // Children run at nice 5, except the second one is a background worker
+    ProcessScheduling scheduling;
+    scheduling.nice = 5;
+    ProcessScheduling background;
+    background.policy = ProcessScheduling::POLICY::BATCH;
+    background.nice = 10;
+
+    int parentNice = getpriority(PRIO_PROCESS, 0);
+    int parentPolicy = sched_getscheduler(0);
+
+    ProcessQueue<SchedulingArgs> procQueue;
+    gSchedulingQueue = &procQueue;
+    gSchedulingRuns = CreateShared<SchedulingRuns>();
+    procQueue.SetScheduling(scheduling);
+    procQueue.AddSchedulingGroup(1, 1, background);
+    if(!gSchedulingRuns || !procQueue.Create(2, fptr, broadcastFptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gSchedulingRuns);
+        return;
+    }
+
+    procQueue.Broadcast(SchedulingArgs{});
+    procQueue.WaitForBroadcast();
+    procQueue.Destroy();
+    gSchedulingQueue = nullptr;
+
+    std::cout << ">>> " << __func__ << ": Child 0 nice " << gSchedulingRuns->nice[0] << " policy " << gSchedulingRuns->policy[0]
+              << ", child 1 nice " << gSchedulingRuns->nice[1] << " policy " << gSchedulingRuns->policy[1] << std::endl;
+    Check(__func__, "children get the pool's scheduling", gSchedulingRuns->nice[0] == 5 && gSchedulingRuns->policy[0] == SCHED_OTHER);
+    Check(__func__, "scheduling group overrides the pool's one", gSchedulingRuns->nice[1] == 10 && gSchedulingRuns->policy[1] == SCHED_BATCH);
+    Check(__func__, "parent keeps its scheduling", getpriority(PRIO_PROCESS, 0) == parentNice && sched_getscheduler(0) == parentPolicy);
+
+    DeleteShared(gSchedulingRuns);
+    gSchedulingRuns = nullptr;
+
+    // A failed setting doesn't stop the others (checked in a child to keep the parent's scheduling).
+    // Note: SIGCHLD may be ignored by pools, so the child reports through shared memory.
+    int* result = CreateShared<int>();
+    pid_t pid = (result ? fork() : -1);
+    if(pid == 0)
+    {
+        ProcessScheduling scheduling;
+        scheduling.policy = ProcessScheduling::POLICY::FIFO;
+        scheduling.priority = 0;    // Invalid
+        scheduling.nice = 7;
+        scheduling.ioClass = ProcessScheduling::IO_CLASS::BEST_EFFORT;
+        scheduling.ioLevel = 3;
+        std::string error;
+        bool isApplied = scheduling.Apply(error);
+        bool isReported = (error.find("sched_setscheduler()") != std::string::npos);
+        bool isNiceSet = (getpriority(PRIO_PROCESS, 0) == 7);
+        bool isIoSet = (syscall(SYS_ioprio_get, 1 /*IOPRIO_WHO_PROCESS*/, 0) == ((2 << 13) | 3));
+        *result = (isApplied ? 0 : 1) | (isReported ? 2 : 0) | (isNiceSet ? 4 : 0) | (isIoSet ? 8 : 0);
+        _exit(0);
+    }
+    if(pid > 0)
+        waitpid(pid, nullptr, 0);
+    Check(__func__, "settings after a failed one are applied and the failure is reported", pid > 0 && *result == 15);
+    DeleteShared(result);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue scheduling test" << std::endl;
+}
+
+// Tenants of processed requests and concurrency of tenant 0 (in shared memory)
+struct TenantRuns
+{
+    int count{0};
+    int tenants[80]{};
+    int running{0};
+    int maxRunning{0};
+};
+static TenantRuns* gTenantRuns = nullptr;
+
+void TestProcessTenants()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue tenants test" << std::endl;
+
+    struct Args
+    {
+        int tenant{0};  // -1 for the request that keeps children busy
+    };
+
+    auto fptr = [](const Args& args)
+    {
+        if(args.tenant < 0)
+        {
+            usleep(100000); // 100 ms
+            return;
+        }
+
+        int index = __atomic_fetch_add(&gTenantRuns->count, 1, __ATOMIC_RELAXED);
+        if(index < 80)
+            gTenantRuns->tenants[index] = args.tenant;
+
+        int running = __atomic_add_fetch(&gTenantRuns->running, 1, __ATOMIC_RELAXED);
+        int maxRunning = __atomic_load_n(&gTenantRuns->maxRunning, __ATOMIC_RELAXED);
+        while(running > maxRunning &&
+              !__atomic_compare_exchange_n(&gTenantRuns->maxRunning, &maxRunning, running, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        usleep(1000); // 1 ms
+        __atomic_sub_fetch(&gTenantRuns->running, 1, __ATOMIC_RELAXED);
+    };
+
+    // Tenant 0 gets 3 times the share of tenant 1 (one child serves them in turns)
+    ProcessQueue<Args> procQueue;
+    Check(__func__, "posting needs a created queue",
+          !procQueue.PostToTenant(Args{0}, 0) && !procQueue.Post(Args{0}) &&
+          procQueue.GetPostStatus() == ProcessQueue<Args>::POST_STATUS::FAILED);
+
+    gTenantRuns = CreateShared<TenantRuns>();
+    if(!gTenantRuns || !procQueue.SetTenantCount(2) || !procQueue.SetTenant(0, 3) || !procQueue.SetTenant(1, 1) ||
+       !procQueue.Create(1, fptr))  // 1 process
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gTenantRuns);
+        return;
+    }
+
+    // Keep the child busy while both tenants post a backlog
+    procQueue.Post(Args{-1});
+    usleep(30000); // 30 ms
+    for(int i = 0; i < 40; i++)
+    {
+        procQueue.PostToTenant(Args{0}, 0);
+        procQueue.PostToTenant(Args{1}, 1);
+    }
+    procQueue.WaitForCompletion();
+    procQueue.Destroy();
+
+    // While both tenants have requests, 3 of every 4 are of tenant 0
+    int tenant0 = 0;
+    for(int i = 0; i < 40; i++)
+        tenant0 += (gTenantRuns->tenants[i] == 0);
+    std::cout << ">>> " << __func__ << ": Tenant 0 got " << tenant0 << " of the first 40 requests" << std::endl;
+    Check(__func__, "tenants share children by their weights", tenant0 >= 28 && tenant0 <= 32);
+
+    // Tenant 0 may run a single request at once whatever the number of children
+    *gTenantRuns = TenantRuns();
+    ProcessQueue<Args> capQueue;
+    if(!capQueue.SetTenantCount(2) || !capQueue.SetTenant(0, 1, 1 /*maxRunning*/) || !capQueue.Create(3, fptr))  // 3 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gTenantRuns);
+        return;
+    }
+
+    for(int i = 0; i < 20; i++)
+        capQueue.PostToTenant(Args{0}, 0);
+    capQueue.WaitForCompletion();
+
+    ProcessQueueStats stats;
+    capQueue.Snapshot(stats);
+    capQueue.Destroy();
+
+    Check(__func__, "tenant runs up to maxRunning requests at once", gTenantRuns->maxRunning == 1);
+    Check(__func__, "tenant requests are all completed", stats.tenants.size() == 2 && stats.tenants[0].completed == 20);
+
+    DeleteShared(gTenantRuns);
+    gTenantRuns = nullptr;
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue tenants test" << std::endl;
+}
+
+void TestProcessAffinity()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessAffinity test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    auto fptr = [](const Args&) {};
+
+    std::vector<ProcessAffinity::Cpu> cpus = ProcessAffinity::GetCpus();
+
+    // Children share cores, the parent runs on the CPUs left (if any) while children are running
+    ProcessQueue<Args> procQueue;
+    procQueue.SetPlacement(ProcessAffinity::PLACEMENT::COMPACT, {}, true /*pinParent*/);
+
+    // Every run must see all the parent's CPUs again
+    std::vector<int> placement[2];
+    for(int run = 0; run < 2; run++)
+    {
+        if(!procQueue.Create(2, fptr))  // 2 processes
+        {
+            std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+            gFailures++;
+            return;
+        }
+
+        for(int i = 0; i < 2; i++)
+            placement[run].push_back(procQueue.GetChildCpu(i));
+
+        for(int i = 0; i < 5; i++)
+            procQueue.Post(Args{i});
+        procQueue.WaitForCompletion();
+        procQueue.Destroy();
+
+        Check(__func__, "parent is unpinned after Destroy()", ProcessAffinity::GetCpus().size() == cpus.size());
+    }
+
+    Check(__func__, "children are placed on CPUs", placement[0][0] >= 0 && placement[0][1] >= 0);
+    Check(__func__, "placement is the same after re-Create()", placement[0] == placement[1]);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessAffinity test" << std::endl;
+}
+
+// Runs of the straggling request in shared memory: the original and its copies
+struct HedgeRuns
+{
+    int runs{0};
+    int copies{0};
+    int cancelled{0};   // The original has been cancelled
+    int slowRuns{0};
+    int slowCopyDone{0};  // The copy that outlives its original has finished
+};
+static HedgeRuns* gHedgeRuns = nullptr;
+
+struct HedgeArgs
+{
+    int count{0};       // -1 for the straggling request, -2 for the one its copy outlives
+};
+static ProcessQueue<HedgeArgs>* gHedgeQueue = nullptr;
+
+void TestProcessHedging()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue hedging test" << std::endl;
+
+    // The first run of the straggler waits until its copy finishes first, copies are fast
+    auto fptr = [](const HedgeArgs& args)
+    {
+        if(args.count >= 0)
+        {
+            usleep(1000); // 1 ms
+            return;
+        }
+
+        if(args.count == -2)
+        {
+            if(__atomic_fetch_add(&gHedgeRuns->slowRuns, 1, __ATOMIC_RELAXED) == 0)
+            {
+                usleep(100000); // 100 ms
+                return;
+            }
+
+            usleep(300000); // 300 ms
+            __atomic_store_n(&gHedgeRuns->slowCopyDone, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        if(__atomic_fetch_add(&gHedgeRuns->runs, 1, __ATOMIC_RELAXED) > 0)
+        {
+            __atomic_add_fetch(&gHedgeRuns->copies, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        for(int i = 0; i < 5000 && !gHedgeQueue->IsCancelled(); i++)
+            usleep(1000);
+        __atomic_store_n(&gHedgeRuns->cancelled, gHedgeQueue->IsCancelled(), __ATOMIC_RELAXED);
+    };
+
+    // Duplicate requests running longer than p99 of service times
+    ProcessQueue<HedgeArgs> procQueue;
+    gHedgeQueue = &procQueue;
+    procQueue.SetHedging(99);
+    gHedgeRuns = CreateShared<HedgeRuns>();
+    if(!gHedgeRuns || !procQueue.Create(2, fptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gHedgeRuns);
+        return;
+    }
+
+    // Enough service times to know the percentile...
+    for(int i = 0; i < 200; i++)
+        procQueue.Post(HedgeArgs{i});
+    procQueue.WaitForCompletion();
+
+    // ...and one straggler for the idle child to hedge
+    procQueue.Post(HedgeArgs{-1});
+    procQueue.WaitForCompletion();
+
+    ProcessQueueStats stats;
+    ProcessQueueLatency latency;
+    procQueue.Snapshot(stats);
+    procQueue.GetLatency(latency);
+
+    // The original finishes first while its copy keeps running
+    procQueue.Post(HedgeArgs{-2});
+    procQueue.WaitForCompletion();
+    int slowCopyDone = __atomic_load_n(&gHedgeRuns->slowCopyDone, __ATOMIC_RELAXED);
+    procQueue.Destroy();
+    gHedgeQueue = nullptr;
+
+    Check(__func__, "straggler is hedged once", gHedgeRuns->copies == 1);
+    Check(__func__, "straggler is cancelled when its copy wins", gHedgeRuns->cancelled == 1);
+    Check(__func__, "copy is counted as the winner", stats.total.hedgeWins >= 1);
+    Check(__func__, "request is counted once", stats.total.requests == 201);
+    Check(__func__, "copies record their service time", latency.service.count == stats.total.requests + stats.total.hedged);
+    Check(__func__, "WaitForCompletion() waits for a running copy", gHedgeRuns->slowRuns == 2 && slowCopyDone == 1);
+
+    DeleteShared(gHedgeRuns);
+    gHedgeRuns = nullptr;
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue hedging test" << std::endl;
+}
+
+// Order in which the child has processed costed requests (in shared memory)
+struct CostOrder
+{
+    int count{0};
+    int costs[16]{};
+};
+static CostOrder* gCostOrder = nullptr;
+
+void TestProcessCost()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue cost test" << std::endl;
+
+    struct Args
+    {
+        int cost{0};    // -1 for the request that keeps the child busy
+    };
+
+    auto fptr = [](const Args& args)
+    {
+        if(args.cost < 0)
+            usleep(100000); // 100 ms
+        else if(gCostOrder->count < 16)
+            gCostOrder->costs[gCostOrder->count++] = args.cost;
+    };
+
+    ProcessQueue<Args> procQueue;
+    gCostOrder = CreateShared<CostOrder>();
+    if(!gCostOrder || !procQueue.EnableCostScheduling() || !procQueue.Create(1, fptr))  // 1 process
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        DeleteShared(gCostOrder);
+        return;
+    }
+
+    // Keep the child busy while the batch is posted in random order of costs
+    procQueue.Post(Args{-1});
+    usleep(30000); // 30 ms
+    const int costs[] = {10, 100000, 0, 1000, 1, 10000000, 100};
+    for(int cost : costs)
+    {
+        if(cost == 0)
+            procQueue.Post(Args{cost});                 // No cost: the cheapest
+        else if(cost == 1000)
+            procQueue.PostToTenant(Args{cost}, 0, cost);
+        else
+            procQueue.Post(Args{cost}, cost);
+    }
+    procQueue.WaitForCompletion();
+    procQueue.Destroy();
+
+    bool isLargestFirst = (gCostOrder->count == (int)(sizeof(costs) / sizeof(costs[0])));
+    for(int i = 1; i < gCostOrder->count; i++)
+        isLargestFirst = isLargestFirst && gCostOrder->costs[i - 1] > gCostOrder->costs[i];
+    Check(__func__, "requests are dequeued the largest first", isLargestFirst);
+
+    DeleteShared(gCostOrder);
+    gCostOrder = nullptr;
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue cost test" << std::endl;
+}
+
+struct BroadcastArgs
+{
+    int command{0};     // 1 - child 0 hangs for a while, 2 - child 0 crashes
+};
+static ProcessQueue<BroadcastArgs>* gBroadcastQueue = nullptr;
+
+void TestProcessBroadcast()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue broadcast test" << std::endl;
+
+    auto fptr = [](const BroadcastArgs&) {};
+    auto broadcastFptr = [](const BroadcastArgs& args)
+    {
+        if(gBroadcastQueue->GetChildIndex() != 0)
+            return;
+
+        if(args.command == 1)
+            usleep(500000); // 500 ms
+        else if(args.command == 2)
+            _exit(1);
+    };
+
+    ProcessQueue<BroadcastArgs> procQueue;
+    Check(__func__, "broadcast needs a created queue",
+          !procQueue.Broadcast(BroadcastArgs{}) && !procQueue.WaitForBroadcast());
+
+    gBroadcastQueue = &procQueue;
+    if(!procQueue.Create(2, fptr, broadcastFptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    // A hung child makes the wait time out...
+    procQueue.Broadcast(BroadcastArgs{1});
+    Check(__func__, "wait for a hung child times out", !procQueue.WaitForBroadcast(100));
+    Check(__func__, "wait succeeds once the child is done", procQueue.WaitForBroadcast());
+
+    // ...and a crashed child isn't waited for
+    procQueue.Broadcast(BroadcastArgs{2});
+    Check(__func__, "crashed child isn't waited for", procQueue.WaitForBroadcast());
+
+    procQueue.Destroy();
+    gBroadcastQueue = nullptr;
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue broadcast test" << std::endl;
+}
+
+// Process queue that keeps its log messages
+struct LogArgs
+{
+    int count{0};
+};
+
+class LoggedQueue : public ProcessQueue<LogArgs>
+{
+public:
+    LoggedQueue() : ProcessQueue<LogArgs>(AUTO_REQUEST_COUNT) {}
+
+    // Is there a message starting with the prefix that has the text?
+    bool HasMessage(const std::string& prefix, const std::string& text) const
+    {
+        for(const std::string& msg : mMessages)
+        {
+            if(msg.compare(0, prefix.size(), prefix) == 0 && msg.find(text) != std::string::npos)
+                return true;
+        }
+        return false;
+    }
+
+    void Info(const std::string& msg) const { PROCESS_POOL_INFO(msg); }
+
+protected:
+    void OnInfo(const std::string& msg) const override { mMessages.push_back(msg); }
+
+private:
+    mutable std::vector<std::string> mMessages;
+};
+static LoggedQueue* gLogQueue = nullptr;
+
+void TestProcessLog()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue log test" << std::endl;
+
+    // The first request logs a message that doesn't fit into a log record
+    auto fptr = [](const LogArgs& args)
+    {
+        if(args.count == 0)
+            gLogQueue->Info(std::string(300, 'x'));
+    };
+
+    // Children log through the ring by default, the parent passes their messages to OnInfo()
+    LoggedQueue procQueue;
+    gLogQueue = &procQueue;
+    if(!procQueue.Create(2, fptr))  // 2 processes
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    for(int i = 0; i < 5; i++)
+        procQueue.Post(LogArgs{i});
+    procQueue.WaitForCompletion();
+    procQueue.Destroy();
+    gLogQueue = nullptr;
+
+#if PROCESS_POOL_LOG_LEVEL >= PROCESS_POOL_LOG_INFO
+    Check(__func__, "subclass gets messages of the queue", procQueue.HasMessage("[INFO]", "Request Queue holds up to"));
+    Check(__func__, "children messages are prefixed with the child index",
+          procQueue.HasMessage("[0] ", "Child 0 (") && procQueue.HasMessage("[1] ", "Child 1 ("));
+    Check(__func__, "cut messages are marked", procQueue.HasMessage("[", "xxxx..."));
+#else
+    Check(__func__, "info messages are compiled out", !procQueue.HasMessage("[INFO]", ""));
+#endif
+
+    // A child that dies after it has claimed a slot doesn't block the ring
+    const unsigned int RECORD_COUNT = 4;
+    size_t ringSize = ProcessLogRing::GetSize(RECORD_COUNT);
+    void* addr = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        std::cout << ">>> " << __func__ << ": mmap() failed" << std::endl;
+        gFailures++;
+        return;
+    }
+
+    ProcessLogRing* ring = ProcessLogRing::Create(addr, RECORD_COUNT);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        ring->Claim();
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+
+    ProcessLogRing::Record record;
+    bool isPushed = ring->Push(ProcessLogger::LOG_LEVEL::INFO, 0, GetMonotonicTimeNs(), "next");
+    bool isPopped = ring->Pop(record) && strcmp(record.msg, "next") == 0;
+    Check(__func__, "slot of a dead child is skipped", isPushed && isPopped && ring->GetDropped() == 1);
+    munmap(addr, ringSize);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue log test" << std::endl;
+}
+
+void TestProcessOutput()
+{
+    std::cout << ">>> " << __func__ << ": Beginning of ProcessQueue output capture test" << std::endl;
+
+    struct Args
+    {
+        int count{0};
+    };
+
+    // Children write lines in pieces, the parent writes out the whole output of every child
+    auto fptr = [](const Args& args)
+    {
+        printf("request ");
+        fflush(stdout);
+        printf("%d\n", args.count);
+        fflush(stdout);
+    };
+
+    // Merged output goes to a file instead of the parent's stdout
+    const char* path = "/tmp/process_pool_output.txt";
+    fflush(stdout);
+    int stdoutFd = dup(STDOUT_FILENO);
+    int fileFd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if(stdoutFd < 0 || fileFd < 0 || dup2(fileFd, STDOUT_FILENO) < 0)
+    {
+        std::cout << ">>> " << __func__ << ": Can't redirect stdout" << std::endl;
+        gFailures++;
+        return;
+    }
+    close(fileFd);
+
+    ProcessQueue<Args> procQueue;
+    procQueue.SetOutputCapture(ProcessPool::OUTPUT_CAPTURE::CHILD, true /*prefixLines*/);
+    bool isCreated = procQueue.Create(2, fptr);  // 2 processes
+    if(isCreated)
+    {
+        for(int i = 0; i < 20; i++)
+            procQueue.Post(Args{i});
+        procQueue.WaitForCompletion();
+        procQueue.Destroy();
+    }
+
+    fflush(stdout);
+    dup2(stdoutFd, STDOUT_FILENO);
+    close(stdoutFd);
+
+    if(!isCreated)
+    {
+        std::cout << ">>> " << __func__ << ": ProcessQueue::Create() failed" << std::endl;
+        gFailures++;
+        unlink(path);
+        return;
+    }
+
+    // Every line of children is complete and prefixed with the child index
+    int requestLines = 0;
+    bool isPrefixed = true;
+    std::ifstream file(path);
+    for(std::string line; std::getline(file, line); )
+    {
+        if(line.find("request ") == std::string::npos)
+            continue;
+        requestLines++;
+        isPrefixed = isPrefixed && (line.compare(0, 12, "[0] request ") == 0 || line.compare(0, 12, "[1] request ") == 0);
+    }
+    unlink(path);
+
+    Check(__func__, "all children output is written out after Destroy()", requestLines == 20);
+    Check(__func__, "lines are complete and prefixed with the child index", isPrefixed);
+
+    std::cout << ">>> " << __func__ << ": End of ProcessQueue output capture test" << std::endl;
+}
+
 int main()
 {
     TestProcessPool();
     TestProcessQueue();
-    return 0;
+    TestLatencyHistogram();
+    TestProcessCapture();
+    TestProcessRcu();
+    TestProcessBarrier();
+    TestProcessTrace();
+    TestProcessProbes();
+    TestProcessPerf();
+    TestProcessMemory();
+    TestProcessTune();
+    TestProcessNuma();
+    TestProcessLimits();
+    TestProcessScheduling();
+    TestProcessTenants();
+    TestProcessAffinity();
+    TestProcessHedging();
+    TestProcessCost();
+    TestProcessBroadcast();
+    TestProcessLog();
+    TestProcessOutput();
+    return (gFailures == 0 ? 0 : 1);
 }
 
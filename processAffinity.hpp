@@ -0,0 +1,248 @@
+//
+// processAffinity.hpp
+//
+#ifndef _PROCESS_AFFINITY_HPP_
+#define _PROCESS_AFFINITY_HPP_
+
+#include <stdio.h>          // fopen(), fscanf()
+#include <dirent.h>         // opendir()
+#include <sched.h>          // sched_getaffinity(), sched_setaffinity()
+#include <unistd.h>         // syscall()
+#include <sys/syscall.h>    // SYS_mbind
+#include <string>           // std::string
+#include <vector>           // std::vector
+#include <algorithm>        // std::sort(), std::find_if()
+
+//
+// CPU topology of the machine (from /sys/devices/system) and placement
+// of children processes on CPUs
+//
+class ProcessAffinity
+{
+public:
+    // How children are placed on CPUs
+    enum class PLACEMENT : char
+    {
+        NONE=1,         // Leave placement to the scheduler
+        COMPACT,        // Fill hyperthreads of a core, then cores of a package (share caches)
+        SCATTER,        // Spread across packages and cores first (more cache and memory bandwidth)
+        PHYSICAL_CORE,  // One child per physical core, hyperthread siblings stay free
+        CPU_LIST        // Child i runs on cpuList[i % cpuList.size()]
+    };
+
+    // Logical CPU and its place in the topology
+    struct Cpu
+    {
+        int cpu{0};
+        int package{0};     // Socket
+        int core{0};        // Core id within the package
+        int thread{0};      // Hyperthread index within the core
+        int node{0};        // NUMA node
+    };
+
+    // NUMA node and its CPUs
+    struct Node
+    {
+        int node{0};
+        std::vector<int> cpus;
+    };
+
+    // CPUs the calling process is allowed to run on
+    static std::vector<Cpu> GetCpus();
+
+    // NUMA nodes of the allowed CPUs in node order
+    static std::vector<Node> GetNodes();
+
+    // Allocate memory pages of the range (not touched yet) on the node only
+    static bool BindMemory(void* addr, size_t size, int node);
+
+    // Get CPU of every child for the placement (empty for PLACEMENT::NONE)
+    static std::vector<int> GetPlacement(PLACEMENT placement, int childCount, const std::vector<int>& cpuList = {});
+
+    // Pin the calling process to the CPUs
+    static bool SetAffinity(const std::vector<int>& cpus);
+
+private:
+    static int ReadInt(const std::string& path, int defaultValue);
+};
+
+//
+// ProcessAffinity class implementation
+//
+inline std::vector<ProcessAffinity::Cpu> ProcessAffinity::GetCpus()
+{
+    std::vector<Cpu> cpus;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return cpus;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        Cpu info;
+        info.cpu = cpu;
+        info.package = ReadInt(dir + "/topology/physical_package_id", 0);
+        info.core = ReadInt(dir + "/topology/core_id", cpu);
+
+        // The CPU directory has a "node<N>" link to its NUMA node
+        DIR* cpuDir = opendir(dir.c_str());
+        if(cpuDir)
+        {
+            struct dirent* entry = nullptr;
+            while((entry = readdir(cpuDir)) != nullptr)
+            {
+                int node = 0;
+                if(sscanf(entry->d_name, "node%d", &node) == 1)
+                {
+                    info.node = node;
+                    break;
+                }
+            }
+            closedir(cpuDir);
+        }
+
+        cpus.push_back(info);
+    }
+
+    // Number hyperthreads of every core in CPU order
+    for(size_t i = 0; i < cpus.size(); i++)
+    {
+        for(size_t j = 0; j < i; j++)
+        {
+            if(cpus[j].package == cpus[i].package && cpus[j].core == cpus[i].core)
+                cpus[i].thread++;
+        }
+    }
+
+    return cpus;
+}
+
+inline std::vector<ProcessAffinity::Node> ProcessAffinity::GetNodes()
+{
+    std::vector<Node> nodes;
+    for(const Cpu& cpu : GetCpus())
+    {
+        auto it = std::find_if(nodes.begin(), nodes.end(), [&](const Node& node) { return node.node == cpu.node; });
+        if(it == nodes.end())
+        {
+            nodes.push_back(Node());
+            nodes.back().node = cpu.node;
+            it = nodes.end() - 1;
+        }
+        it->cpus.push_back(cpu.cpu);
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const Node& a, const Node& b) { return a.node < b.node; });
+    return nodes;
+}
+
+inline bool ProcessAffinity::BindMemory(void* addr, size_t size, int node)
+{
+    // Note: Call mbind() directly to not depend on libnuma
+    const int MPOL_BIND_MODE = 2;   // MPOL_BIND of <numaif.h>
+    const size_t BITS = sizeof(unsigned long) * 8;
+    if(node < 0 || node >= (int)(BITS * 16))
+        return false;
+
+    unsigned long nodeMask[16]{};
+    nodeMask[node / BITS] = 1UL << (node % BITS);
+    return (syscall(SYS_mbind, addr, size, MPOL_BIND_MODE, nodeMask, BITS * 16 + 1, 0) == 0);
+}
+
+inline std::vector<int> ProcessAffinity::GetPlacement(PLACEMENT placement, int childCount,
+                                                      const std::vector<int>& cpuList /*= {}*/)
+{
+    std::vector<int> order;
+    if(placement == PLACEMENT::CPU_LIST)
+    {
+        order = cpuList;
+    }
+    else if(placement != PLACEMENT::NONE)
+    {
+        std::vector<Cpu> cpus = GetCpus();
+
+        // Rank of the core within its package to interleave packages
+        std::vector<int> coreRank(cpus.size(), 0);
+        for(size_t i = 0; i < cpus.size(); i++)
+        {
+            for(size_t j = 0; j < cpus.size(); j++)
+            {
+                if(cpus[j].package == cpus[i].package && cpus[j].thread == 0 && cpus[j].core < cpus[i].core)
+                    coreRank[i]++;
+            }
+        }
+
+        std::vector<size_t> index(cpus.size());
+        for(size_t i = 0; i < index.size(); i++)
+            index[i] = i;
+
+        std::sort(index.begin(), index.end(), [&](size_t a, size_t b)
+        {
+            const Cpu& x = cpus[a];
+            const Cpu& y = cpus[b];
+            if(placement == PLACEMENT::SCATTER)
+            {
+                if(x.thread != y.thread)
+                    return x.thread < y.thread;
+                if(coreRank[a] != coreRank[b])
+                    return coreRank[a] < coreRank[b];
+                return x.package < y.package;
+            }
+
+            // COMPACT and PHYSICAL_CORE
+            if(x.package != y.package)
+                return x.package < y.package;
+            if(x.core != y.core)
+                return x.core < y.core;
+            return x.thread < y.thread;
+        });
+
+        for(size_t i : index)
+        {
+            if(placement != PLACEMENT::PHYSICAL_CORE || cpus[i].thread == 0)
+                order.push_back(cpus[i].cpu);
+        }
+    }
+
+    std::vector<int> placementCpus;
+    if(order.empty())
+        return placementCpus;
+
+    // More children than CPUs: wrap around
+    for(int i = 0; i < childCount; i++)
+        placementCpus.push_back(order[i % order.size()]);
+    return placementCpus;
+}
+
+inline bool ProcessAffinity::SetAffinity(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus)
+    {
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+
+    return (CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0);
+}
+
+inline int ProcessAffinity::ReadInt(const std::string& path, int defaultValue)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if(!file)
+        return defaultValue;
+
+    int value = defaultValue;
+    if(fscanf(file, "%d", &value) != 1)
+        value = defaultValue;
+    fclose(file);
+    return value;
+}
+
+#endif // _PROCESS_AFFINITY_HPP_
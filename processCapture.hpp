@@ -0,0 +1,208 @@
+//
+// processCapture.hpp
+//
+#ifndef _PROCESS_CAPTURE_HPP_
+#define _PROCESS_CAPTURE_HPP_
+
+#include <stdint.h>         // int32_t, uint32_t, uint64_t
+#include <stdio.h>          // fopen(), fwrite(), fread()
+#include <string.h>         // memcmp()
+#include <string>           // std::string
+#include "processPool.hpp"
+
+//
+// Compact binary log of requests posted into a queue (see ProcessQueue::StartCapture()
+// and ProcessQueue::Replay()). The file starts with Header followed by records:
+// Record and record.size bytes of the request. Record keeps the tenant, cost hint
+// and NUMA node the request was posted with so the replay takes the same path.
+// Note: Requests are stored as raw bytes, so they must be trivially copyable.
+//
+class ProcessCapture : public ProcessLogger
+{
+public:
+    struct Header
+    {
+        char magic[8]{'P', 'P', 'C', 'A', 'P', 'T', 'R', 0};
+        uint32_t version{2};        // 2: Records keep tenant, cost and NUMA node
+        uint32_t argsSize{0};       // Size of the captured request type
+    };
+
+    struct Record
+    {
+        uint64_t offsetNs{0};       // Post time since the first record
+        uint32_t size{0};           // Size of the request bytes that follow
+        uint32_t tenant{0};         // Tenant of the request (see ProcessQueue::PostToTenant())
+        uint64_t cost{0};           // Cost hint, 0 if none (see ProcessQueue::EnableCostScheduling())
+        int32_t numaNode{-1};       // NUMA node the request was posted to, -1 if any (see ProcessQueue::PostToNode())
+        uint32_t reserved{0};
+    };
+
+    ProcessCapture() = default;
+    virtual ~ProcessCapture() { Close(); }
+
+    // Omit implementation of the copy constructor and assignment operator
+    ProcessCapture(const ProcessCapture&) = delete;
+    ProcessCapture& operator=(const ProcessCapture&) = delete;
+
+    // Create a new log for requests of argsSize bytes
+    bool Create(const std::string& path, uint32_t argsSize);
+
+    // Open existing log of requests of argsSize bytes for reading
+    bool Open(const std::string& path, uint32_t argsSize);
+
+    void Close();
+    bool IsOpen() const { return (mFile != nullptr); }
+
+    // Append request posted at timeNs (monotonic) with its tenant, cost hint and NUMA node
+    bool Write(uint64_t timeNs, const void* data, uint32_t size, uint32_t tenant = 0, uint64_t cost = 0, int32_t numaNode = -1);
+
+    // Read the next request and its record. Returns false at the end of the log.
+    bool Read(Record& record, void* data, uint32_t size);
+
+    uint64_t GetCount() const { return mCount; }
+
+private:
+    static const size_t BUFFER_SIZE = 1024 * 1024;  // Large stdio buffer: Write() is on Post() path
+
+    FILE* mFile{nullptr};
+    std::string mPath;
+    bool mIsWriter{false};
+    uint64_t mStartNs{0};
+    uint64_t mCount{0};
+};
+
+//
+// ProcessCapture class implementation
+//
+inline bool ProcessCapture::Create(const std::string& path, uint32_t argsSize)
+{
+    Close();
+
+    mFile = fopen(path.c_str(), "wb");
+    if(!mFile)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Can't create capture file '" << path << "' because " << errmsg);
+        return false;
+    }
+    setvbuf(mFile, nullptr, _IOFBF, BUFFER_SIZE);
+
+    Header header;
+    header.argsSize = argsSize;
+    if(fwrite(&header, sizeof(header), 1, mFile) != 1)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Failed to write capture file '" << path << "' because " << errmsg);
+        Close();
+        return false;
+    }
+
+    mPath = path;
+    mIsWriter = true;
+    mStartNs = 0;
+    mCount = 0;
+    return true;
+}
+
+inline bool ProcessCapture::Open(const std::string& path, uint32_t argsSize)
+{
+    Close();
+
+    mFile = fopen(path.c_str(), "rb");
+    if(!mFile)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Can't open capture file '" << path << "' because " << errmsg);
+        return false;
+    }
+    setvbuf(mFile, nullptr, _IOFBF, BUFFER_SIZE);
+
+    Header header;
+    Header expected;
+    if(fread(&header, sizeof(header), 1, mFile) != 1 ||
+       memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version)
+    {
+        PROCESS_POOL_ERROR("'" << path << "' is not a capture file");
+        Close();
+        return false;
+    }
+
+    if(header.argsSize != argsSize)
+    {
+        PROCESS_POOL_ERROR("Capture file '" << path << "' has requests of " << header.argsSize
+                           << " bytes instead of " << argsSize);
+        Close();
+        return false;
+    }
+
+    mPath = path;
+    mIsWriter = false;
+    mCount = 0;
+    return true;
+}
+
+inline void ProcessCapture::Close()
+{
+    if(!mFile)
+        return;
+
+    if(fclose(mFile) != 0 && mIsWriter)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Failed to write capture file '" << mPath << "' because " << errmsg);
+    }
+    else if(mIsWriter)
+    {
+        PROCESS_POOL_INFO("Captured " << mCount << " requests into '" << mPath << "'");
+    }
+
+    mFile = nullptr;
+    mIsWriter = false;
+}
+
+inline bool ProcessCapture::Write(uint64_t timeNs, const void* data, uint32_t size, uint32_t tenant /*= 0*/,
+                                  uint64_t cost /*= 0*/, int32_t numaNode /*= -1*/)
+{
+    if(!mFile || !mIsWriter)
+        return false;
+
+    if(mCount == 0)
+        mStartNs = timeNs;
+
+    Record record;
+    record.offsetNs = timeNs - mStartNs;
+    record.size = size;
+    record.tenant = tenant;
+    record.cost = cost;
+    record.numaNode = numaNode;
+    if(fwrite(&record, sizeof(record), 1, mFile) != 1 || fwrite(data, size, 1, mFile) != 1)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Failed to write capture file '" << mPath << "' because " << errmsg << ", stop capturing");
+        Close();
+        return false;
+    }
+
+    mCount++;
+    return true;
+}
+
+inline bool ProcessCapture::Read(Record& record, void* data, uint32_t size)
+{
+    if(!mFile || mIsWriter)
+        return false;
+
+    if(fread(&record, sizeof(record), 1, mFile) != 1)
+        return false; // End of the log
+
+    if(record.size != size || fread(data, size, 1, mFile) != 1)
+    {
+        PROCESS_POOL_ERROR("Capture file '" << mPath << "' is truncated or corrupted at request " << mCount);
+        return false;
+    }
+
+    mCount++;
+    return true;
+}
+
+#endif // _PROCESS_CAPTURE_HPP_
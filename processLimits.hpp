@@ -0,0 +1,299 @@
+//
+// processLimits.hpp
+//
+#ifndef _PROCESS_LIMITS_HPP_
+#define _PROCESS_LIMITS_HPP_
+
+#include <stdint.h>         // uint64_t
+#include <stdio.h>          // fopen(), fgets()
+#include <stdlib.h>         // strtod(), strtoull()
+#include <string.h>         // strncmp(), strstr()
+#include <limits.h>         // UINT_MAX
+#include <math.h>           // ceil()
+#include <unistd.h>         // sysconf()
+#include <sched.h>          // sched_getaffinity()
+#include <string>           // std::string
+#include <vector>           // std::vector
+
+//
+// Resources the process is allowed to use: CPU affinity and cgroup limits.
+// Note: Containers usually see all host CPUs and memory in /proc/cpuinfo,
+// /proc/meminfo and sysconf(), the actual limits come from the affinity mask
+// and cgroups (v2, or v1 cpu and memory controllers).
+//
+class ProcessLimits
+{
+public:
+    // Number of CPUs the process may run on (sched_getaffinity)
+    static int GetAffinityCpuCount();
+
+    // CPU bandwidth limit of the process cgroup in CPUs (v2 cpu.max or
+    // v1 cpu.cfs_quota_us / cpu.cfs_period_us), 0 if it's not limited
+    static double GetCgroupCpuLimit();
+
+    // Number of CPUs the process can keep busy: the affinity mask bounded
+    // by the cgroup bandwidth limit (rounded up)
+    static int GetCpuLimit();
+
+    // Memory limit of the process cgroup in bytes (v2 memory.max or
+    // v1 memory.limit_in_bytes), 0 if it's not limited
+    static uint64_t GetCgroupMemoryLimit();
+
+    // Memory the process may use: physical memory bounded by the cgroup limit
+    static uint64_t GetMemoryLimit();
+
+    // Number of children to create by default: one per CPU the process can keep busy,
+    // but no more than fit into the memory limit if childMemory bytes is given
+    static int GetProcCount(uint64_t childMemory = 0);
+
+    // Number of requests of requestSize bytes to fit into MEMORY_SHARE of the memory limit
+    static unsigned int GetRequestCount(size_t requestSize);
+
+    static const unsigned int MEMORY_SHARE = 16;    // 1/16 of the memory limit for requests
+
+private:
+    // Directories of the process cgroup from its own up to the root of the hierarchy:
+    // cgroup v2 if controller is nullptr or cgroup v1 of the controller.
+    // Returns an empty list if the hierarchy isn't mounted.
+    static std::vector<std::string> GetCgroupDirs(const char* controller);
+
+    // Is token in the comma separated list?
+    static bool HasToken(const char* list, const char* token);
+
+    // Read the first line of the file
+    static bool ReadLine(const std::string& path, char* line, size_t size);
+};
+
+//
+// ProcessLimits class implementation
+//
+inline int ProcessLimits::GetAffinityCpuCount()
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+        return CPU_COUNT(&cpus);
+
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0 ? (int)count : 1);
+}
+
+inline double ProcessLimits::GetCgroupCpuLimit()
+{
+    // Every ancestor may limit the bandwidth, the strictest limit wins.
+    // Note: The root cgroup has no limits
+    double limit = 0;
+    char line[128]{};
+
+    // cgroup v2 cpu.max is "<quota> <period>" or "max <period>"
+    for(const std::string& dir : GetCgroupDirs(nullptr))
+    {
+        if(ReadLine(dir + "/cpu.max", line, sizeof(line)) && strncmp(line, "max", 3) != 0)
+        {
+            char* next = nullptr;
+            double quota = strtod(line, &next);
+            double period = strtod(next, nullptr);
+            if(quota > 0 && period > 0 && (limit == 0 || quota / period < limit))
+                limit = quota / period;
+        }
+    }
+
+    // cgroup v1 quota is -1 if not limited
+    for(const std::string& dir : GetCgroupDirs("cpu"))
+    {
+        if(!ReadLine(dir + "/cpu.cfs_quota_us", line, sizeof(line)))
+            continue;
+
+        double quota = strtod(line, nullptr);
+        if(quota > 0 && ReadLine(dir + "/cpu.cfs_period_us", line, sizeof(line)))
+        {
+            double period = strtod(line, nullptr);
+            if(period > 0 && (limit == 0 || quota / period < limit))
+                limit = quota / period;
+        }
+    }
+
+    return limit;
+}
+
+inline int ProcessLimits::GetCpuLimit()
+{
+    int count = GetAffinityCpuCount();
+    double limit = GetCgroupCpuLimit();
+    if(limit > 0 && ceil(limit) < count)
+        count = (int)ceil(limit);
+    return (count > 0 ? count : 1);
+}
+
+inline uint64_t ProcessLimits::GetCgroupMemoryLimit()
+{
+    // Note: cgroup v1 reports "no limit" as a huge number rounded down to the page size
+    const uint64_t NO_LIMIT = 1ULL << 62;
+    uint64_t limit = 0;
+    char line[128]{};
+
+    // cgroup v2 memory.max is "<bytes>" or "max"
+    for(const std::string& dir : GetCgroupDirs(nullptr))
+    {
+        if(ReadLine(dir + "/memory.max", line, sizeof(line)) && strncmp(line, "max", 3) != 0)
+        {
+            uint64_t value = strtoull(line, nullptr, 10);
+            if(value > 0 && (limit == 0 || value < limit))
+                limit = value;
+        }
+    }
+
+    for(const std::string& dir : GetCgroupDirs("memory"))
+    {
+        if(ReadLine(dir + "/memory.limit_in_bytes", line, sizeof(line)))
+        {
+            uint64_t value = strtoull(line, nullptr, 10);
+            if(value > 0 && value < NO_LIMIT && (limit == 0 || value < limit))
+                limit = value;
+        }
+    }
+
+    return limit;
+}
+
+inline uint64_t ProcessLimits::GetMemoryLimit()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t limit = (pages > 0 && pageSize > 0 ? (uint64_t)pages * pageSize : 0);
+
+    uint64_t cgroupLimit = GetCgroupMemoryLimit();
+    if(cgroupLimit > 0 && (limit == 0 || cgroupLimit < limit))
+        limit = cgroupLimit;
+    return limit;
+}
+
+inline int ProcessLimits::GetProcCount(uint64_t childMemory /*= 0*/)
+{
+    int count = GetCpuLimit();
+    if(childMemory > 0)
+    {
+        uint64_t memoryCount = GetMemoryLimit() / childMemory;
+        if(memoryCount < (uint64_t)count)
+            count = (int)memoryCount;
+    }
+    return (count > 0 ? count : 1);
+}
+
+inline unsigned int ProcessLimits::GetRequestCount(size_t requestSize)
+{
+    uint64_t count = GetMemoryLimit() / MEMORY_SHARE / (requestSize > 0 ? requestSize : 1);
+    if(count > UINT_MAX)
+        count = UINT_MAX;
+    return (count > 0 ? (unsigned int)count : 1);
+}
+
+inline std::vector<std::string> ProcessLimits::GetCgroupDirs(const char* controller)
+{
+    std::vector<std::string> dirs;
+
+    // Find where the hierarchy is mounted (e.g. /sys/fs/cgroup/cpu for v1 cpu controller,
+    // /sys/fs/cgroup or /sys/fs/cgroup/unified for v2) and its root cgroup.
+    // mountinfo line: "<id> <parent> <dev> <root> <mount point> <options> - <fstype> <source> <super options>"
+    FILE* file = fopen("/proc/self/mountinfo", "r");
+    if(!file)
+        return dirs;
+
+    std::string mountPoint, root;
+    char line[1024]{};
+    while(fgets(line, sizeof(line), file))
+    {
+        const char* separator = strstr(line, " - ");
+        char fsType[64]{}, superOptions[512]{};
+        if(!separator || sscanf(separator, " - %63s %*s %511s", fsType, superOptions) < 1)
+            continue;
+
+        bool isMatch = (controller ? strcmp(fsType, "cgroup") == 0 && HasToken(superOptions, controller)
+                                   : strcmp(fsType, "cgroup2") == 0);
+        char rootPath[512]{}, path[512]{};
+        if(isMatch && sscanf(line, "%*s %*s %*s %511s %511s", rootPath, path) == 2)
+        {
+            root = rootPath;
+            mountPoint = path;
+            break;
+        }
+    }
+    fclose(file);
+
+    if(mountPoint.empty())
+        return dirs;
+
+    // The process cgroup: "0::<path>" for v2, "<id>:<controllers>:<path>" for v1
+    file = fopen("/proc/self/cgroup", "r");
+    if(!file)
+        return dirs;
+
+    std::string cgroup;
+    while(fgets(line, sizeof(line), file))
+    {
+        char* end = strchr(line, '\n');
+        if(end)
+            *end = 0;
+
+        char* controllers = strchr(line, ':');
+        char* path = (controllers ? strchr(controllers + 1, ':') : nullptr);
+        if(!path)
+            continue;
+        *controllers++ = 0;
+        *path++ = 0;
+
+        if(controller ? HasToken(controllers, controller) : strcmp(line, "0") == 0)
+        {
+            cgroup = path;
+            break;
+        }
+    }
+    fclose(file);
+
+    if(cgroup.empty())
+        return dirs;
+
+    // Note: In a container the mount point might be the container's cgroup
+    // rather than the root of the hierarchy
+    if(root != "/" && cgroup.compare(0, root.size(), root) == 0)
+        cgroup.erase(0, root.size());
+    while(!cgroup.empty() && cgroup.back() == '/')
+        cgroup.pop_back();
+
+    std::string dir = mountPoint + cgroup;
+    while(true)
+    {
+        dirs.push_back(dir);
+
+        size_t pos = dir.rfind('/');
+        if(dir.size() <= mountPoint.size() || pos == std::string::npos || pos < mountPoint.size())
+            break;
+        dir.erase(pos);
+    }
+
+    return dirs;
+}
+
+inline bool ProcessLimits::HasToken(const char* list, const char* token)
+{
+    size_t size = strlen(token);
+    for(const char* pos = strstr(list, token); pos; pos = strstr(pos + 1, token))
+    {
+        if((pos == list || pos[-1] == ',') && (pos[size] == ',' || pos[size] == 0))
+            return true;
+    }
+    return false;
+}
+
+inline bool ProcessLimits::ReadLine(const std::string& path, char* line, size_t size)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if(!file)
+        return false;
+
+    bool result = (fgets(line, size, file) != nullptr);
+    fclose(file);
+    return result;
+}
+
+#endif // _PROCESS_LIMITS_HPP_
@@ -0,0 +1,208 @@
+//
+// processLog.hpp
+//
+#ifndef _PROCESS_LOG_HPP_
+#define _PROCESS_LOG_HPP_
+
+#include <stdint.h>         // uint64_t
+#include <string.h>         // strncpy()
+#include <errno.h>          // errno
+#include <signal.h>         // kill()
+#include <unistd.h>         // getpid()
+#include <string>           // std::string
+#include <iostream>         // std::cout
+
+//
+// Compile-time log level. Log sites above this level are removed entirely.
+// INFO messages are compiled out by default since the default OnInfo() drops them,
+// build with -DPROCESS_POOL_LOG_LEVEL=PROCESS_POOL_LOG_INFO to get them.
+//
+#define PROCESS_POOL_LOG_NONE   0
+#define PROCESS_POOL_LOG_ERROR  1
+#define PROCESS_POOL_LOG_INFO   2
+
+#ifndef PROCESS_POOL_LOG_LEVEL
+#define PROCESS_POOL_LOG_LEVEL PROCESS_POOL_LOG_ERROR
+#endif
+
+//
+// Base class for classes that log with PROCESS_POOL_INFO/PROCESS_POOL_ERROR
+//
+class ProcessLogger
+{
+public:
+    enum class LOG_LEVEL : char
+    {
+        ERROR=1,
+        INFO
+    };
+
+    virtual ~ProcessLogger() = default;
+
+protected:
+    // Logging
+    virtual void OnInfo(const std::string& /*msg*/) const { /*std::cout << msg << std::endl;*/ }
+    virtual void OnError(const std::string& msg) const { std::cout << msg << std::endl; }
+
+    // Called by the logging macros
+    virtual void Log(LOG_LEVEL level, const std::string& msg) const
+    {
+        if(level == LOG_LEVEL::ERROR)
+            OnError(msg);
+        else
+            OnInfo(msg);
+    }
+};
+
+//
+// Bounded lock-free ring of log records in shared memory.
+// Children (multiple producers) add records, the parent (single consumer)
+// drains them. If the ring is full, the record is dropped and counted.
+// A child claims a slot with its pid, so the parent skips the slot of a child
+// that died before it published the record (the record is counted as dropped).
+// Messages longer than MAX_MESSAGE_SIZE - 1 are cut and end with "...".
+// Note: The ring is placed into memory provided by the caller (see GetSize()).
+//
+class ProcessLogRing
+{
+public:
+    static const size_t MAX_MESSAGE_SIZE = 232;
+
+    struct Record
+    {
+        uint64_t seq{0};            // Slot sequence (see Claim/Publish/Pop)
+        uint64_t timeNs{0};
+        int childIndex{0};
+        ProcessLogger::LOG_LEVEL level{ProcessLogger::LOG_LEVEL::INFO};
+        char msg[MAX_MESSAGE_SIZE]{};
+    };
+
+    static size_t GetSize(unsigned int recordCount) { return sizeof(ProcessLogRing) + sizeof(Record) * recordCount; }
+
+    static ProcessLogRing* Create(void* addr, unsigned int recordCount)
+    {
+        ProcessLogRing* ring = new (addr) ProcessLogRing;
+        ring->mRecordCount = recordCount;
+        for(unsigned int i = 0; i < recordCount; i++)
+            new (&ring->GetRecord(i)) Record;
+        for(unsigned int i = 0; i < recordCount; i++)
+            ring->GetRecord(i).seq = i;
+        return ring;
+    }
+
+    // Add record (any process). Returns false if the ring is full.
+    bool Push(ProcessLogger::LOG_LEVEL level, int childIndex, uint64_t timeNs, const std::string& msg)
+    {
+        Record* record = Claim();
+        if(!record)
+            return false;
+
+        record->timeNs = timeNs;
+        record->childIndex = childIndex;
+        record->level = level;
+        strncpy(record->msg, msg.c_str(), sizeof(record->msg) - 1);
+        record->msg[sizeof(record->msg) - 1] = 0;
+        if(msg.size() >= sizeof(record->msg))
+            strcpy(record->msg + sizeof(record->msg) - 4, "...");
+
+        Publish(record);
+        return true;
+    }
+
+    // Take the next free slot for the calling process (Push() is Claim() and Publish()).
+    // Returns nullptr if the ring is full.
+    Record* Claim()
+    {
+        uint64_t owner = (uint64_t)getpid() << POS_BITS;
+        uint64_t pos = __atomic_load_n(&mTail, __ATOMIC_RELAXED);
+
+        while(true)
+        {
+            Record* record = &GetRecord(pos % mRecordCount);
+            uint64_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+            int64_t diff = (int64_t)(seq & POS_MASK) - (int64_t)pos;
+
+            if(seq == pos)
+            {
+                // The slot is free, claim it and move the tail past it
+                if(__atomic_compare_exchange_n(&record->seq, &seq, owner | pos, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                {
+                    __atomic_compare_exchange_n(&mTail, &pos, pos + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                    return record;
+                }
+            }
+            else if(diff == 0)
+            {
+                // Another child has claimed it, help it move the tail
+                __atomic_compare_exchange_n(&mTail, &pos, pos + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            }
+            else if(diff < 0)
+            {
+                // The parent hasn't drained this slot yet
+                __atomic_add_fetch(&mDropped, 1, __ATOMIC_RELAXED);
+                return nullptr;
+            }
+            pos = __atomic_load_n(&mTail, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Pass the claimed slot with the record to the parent
+    void Publish(Record* record)
+    {
+        uint64_t pos = __atomic_load_n(&record->seq, __ATOMIC_RELAXED) & POS_MASK;
+        __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+
+    // Get the oldest record (parent only). Returns false if the ring is empty
+    // or the oldest record is still being written.
+    bool Pop(Record& out)
+    {
+        while(true)
+        {
+            Record& record = GetRecord(mHead % mRecordCount);
+            uint64_t seq = __atomic_load_n(&record.seq, __ATOMIC_ACQUIRE);
+            if(seq == mHead + 1)
+            {
+                out = record;
+                ReleaseHead(record);
+                return true;
+            }
+
+            // Skip the slot if the child that claimed it is gone
+            // Note: Children are not zombies (see ProcessPool::Create()), kill() fails once they exit
+            pid_t owner = (pid_t)(seq >> POS_BITS);
+            if(owner == 0 || (seq & POS_MASK) != mHead || kill(owner, 0) == 0 || errno != ESRCH)
+                return false;
+
+            uint64_t pos = mHead;
+            __atomic_compare_exchange_n(&mTail, &pos, mHead + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&mDropped, 1, __ATOMIC_RELAXED);
+            ReleaseHead(record);
+        }
+    }
+
+    // Get and reset the number of dropped records
+    uint64_t GetDropped() { return __atomic_exchange_n(&mDropped, 0, __ATOMIC_RELAXED); }
+
+private:
+    Record& GetRecord(unsigned int index) { return ((Record*)(this + 1))[index]; }
+
+    // Pass the slot back to children for the next round
+    void ReleaseHead(Record& record)
+    {
+        __atomic_store_n(&record.seq, mHead + mRecordCount, __ATOMIC_RELEASE);
+        mHead++;
+    }
+
+    // Slot sequence: position in the ring, with the pid of the child in the upper bits
+    // while the child writes the record
+    static const int POS_BITS = 40;
+    static const uint64_t POS_MASK = (1ULL << POS_BITS) - 1;
+
+    alignas(64) uint64_t mTail{0};      // Next slot to write (children)
+    alignas(64) uint64_t mHead{0};      // Next slot to read (parent)
+    uint64_t mDropped{0};
+    unsigned int mRecordCount{0};
+};
+
+#endif // _PROCESS_LOG_HPP_
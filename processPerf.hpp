@@ -0,0 +1,156 @@
+//
+// processPerf.hpp
+//
+#ifndef _PROCESS_PERF_HPP_
+#define _PROCESS_PERF_HPP_
+
+#include <stdint.h>             // uint64_t
+#include <string.h>             // memset()
+#include <unistd.h>             // syscall(), read(), close()
+#include <sys/syscall.h>        // SYS_perf_event_open
+#include <sys/resource.h>       // getrusage()
+#include <linux/perf_event.h>   // perf_event_attr
+#include "processStats.hpp"
+
+//
+// Per-process hardware/software counters (perf_event_open).
+// Must be opened by the process to be measured, e.g. by a child right after fork.
+// Counters that are not available (no PMU in a VM, perf_event_paranoid, seccomp)
+// are left closed. If no counter could be opened at all, then task clock,
+// context switches and page faults come from getrusage() instead.
+//
+class ProcessPerfCounters
+{
+public:
+    enum COUNTER
+    {
+        TASK_CLOCK=0,
+        CONTEXT_SWITCHES,
+        PAGE_FAULTS,
+        CYCLES,
+        INSTRUCTIONS,
+        COUNTER_COUNT
+    };
+
+    ProcessPerfCounters() = default;
+    ~ProcessPerfCounters() { Close(); }
+
+    // Omit implementation of the copy constructor and assignment operator
+    ProcessPerfCounters(const ProcessPerfCounters&) = delete;
+    ProcessPerfCounters& operator=(const ProcessPerfCounters&) = delete;
+
+    // Open counters for the calling process.
+    // Returns false if perf events are not available (getrusage() is used).
+    bool Open();
+    void Close();
+
+    bool IsOpen(COUNTER counter) const { return (mFds[counter] >= 0); }
+
+    // Read counters since Open() into the perf fields of stats.
+    // Note: Unavailable hardware counters are reported as 0.
+    void Read(ProcessChildStats& stats) const;
+
+private:
+    uint64_t ReadCounter(COUNTER counter) const;
+
+    int mFds[COUNTER_COUNT] = {-1, -1, -1, -1, -1};
+    bool mUseRusage{false};
+};
+
+//
+// ProcessPerfCounters class implementation
+//
+inline bool ProcessPerfCounters::Open()
+{
+    Close();
+
+    static const struct { uint32_t type; uint64_t config; } events[COUNTER_COUNT] =
+    {
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS }
+    };
+
+    bool hasCounters = false;
+    for(int counter = 0; counter < COUNTER_COUNT; counter++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[counter].type;
+        attr.config = events[counter].config;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Measure the calling process on any CPU. Context switches and page faults
+        // happen in the kernel, so try to include it first and fall back to the user
+        // space only (allowed with perf_event_paranoid=2).
+        mFds[counter] = (int)syscall(SYS_perf_event_open, &attr, 0 /*pid*/, -1 /*cpu*/, -1 /*group*/, 0);
+        if(mFds[counter] < 0)
+        {
+            attr.exclude_kernel = 1;
+            mFds[counter] = (int)syscall(SYS_perf_event_open, &attr, 0 /*pid*/, -1 /*cpu*/, -1 /*group*/, 0);
+        }
+
+        if(mFds[counter] >= 0)
+            hasCounters = true;
+    }
+
+    mUseRusage = !hasCounters;
+    return hasCounters;
+}
+
+inline void ProcessPerfCounters::Close()
+{
+    for(int counter = 0; counter < COUNTER_COUNT; counter++)
+    {
+        if(mFds[counter] >= 0)
+            close(mFds[counter]);
+        mFds[counter] = -1;
+    }
+    mUseRusage = false;
+}
+
+inline uint64_t ProcessPerfCounters::ReadCounter(COUNTER counter) const
+{
+    if(mFds[counter] < 0)
+        return 0;
+
+    // Value, time enabled, time running
+    uint64_t values[3] = {0, 0, 0};
+    if(read(mFds[counter], values, sizeof(values)) != sizeof(values))
+        return 0;
+
+    // Scale the value if the counter was multiplexed with other events
+    if(values[2] && values[2] < values[1])
+        return (uint64_t)((double)values[0] * values[1] / values[2]);
+
+    return values[0];
+}
+
+inline void ProcessPerfCounters::Read(ProcessChildStats& stats) const
+{
+    if(mUseRusage)
+    {
+        struct rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+
+        stats.taskClockNs = ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+                            ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+        stats.contextSwitches = usage.ru_nvcsw + usage.ru_nivcsw;
+        stats.pageFaults = usage.ru_minflt + usage.ru_majflt;
+        stats.cycles = 0;
+        stats.instructions = 0;
+        return;
+    }
+
+    stats.taskClockNs = ReadCounter(TASK_CLOCK);
+    stats.contextSwitches = ReadCounter(CONTEXT_SWITCHES);
+    stats.pageFaults = ReadCounter(PAGE_FAULTS);
+    stats.cycles = ReadCounter(CYCLES);
+    stats.instructions = ReadCounter(INSTRUCTIONS);
+}
+
+#endif // _PROCESS_PERF_HPP_
@@ -6,13 +6,20 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>    // std::find()
 #include <iostream>     // std::cout
 #include <signal.h>     // sighandler_t
+#include "processProbes.hpp"
+#include "processLog.hpp"
+#include "processStats.hpp"
+#include "processAffinity.hpp"
+#include "processLimits.hpp"
+#include "processScheduling.hpp"
 
 //
 // Utility class to fork children processes and wait for them to exit
 //
-class ProcessPool
+class ProcessPool : public ProcessLogger
 {
 public:
     ProcessPool() = default;
@@ -28,9 +35,20 @@ public:
     // If maxConcurrentProcs is 0 then procCount will be used.
     bool Create(int procCount, int maxConcurrentProcs=0)
     {
+        if(procCount == AUTO_PROC_COUNT)
+            procCount = GetAutoProcCount();
         return Fork(procCount, (maxConcurrentProcs > 0 ? maxConcurrentProcs : procCount));
     }
 
+    // procCount to size the pool by CPUs and memory the process is allowed to use
+    // in a container (affinity mask and cgroup limits, see GetAutoProcCount())
+    static const int AUTO_PROC_COUNT = -1;
+
+    // Number of children for AUTO_PROC_COUNT: one per CPU the process can keep busy,
+    // but no more than fit into the memory limit if the private memory threshold
+    // of SetMemoryMonitor() is set (see ProcessLimits::GetProcCount())
+    int GetAutoProcCount() const;
+
     // Exit/Idle completed child:
     // If keepIdle is true then idle process instead of exiting.
     // Parent will terminate process later.
@@ -40,7 +58,7 @@ public:
     bool IsParent() const { return (mChildIndex < 0); }
     bool IsChild() const { return !IsParent(); }
     pid_t GetParent() { return mParentPID; }
-    int GetChildIndex() { return mChildIndex; }
+    int GetChildIndex() const { return mChildIndex; }
 
     // Notification sent to derived class to collect statistics, etc
     enum class NOTIFY_TYPE : char
@@ -48,20 +66,117 @@ public:
         PRE_FORK=1,         // Send right before forking children
         CHILD_FORK,         // Send right after forking a child
         POST_FORK,          // Send right after forking all children
-        CHILDREN_DONE       // Send right after all children done (but might be alive and idle)
+        CHILDREN_DONE,      // Send right after all children done (but might be alive and idle)
+        STATS               // Send periodically to collect statistics (see ProcessQueue::SetStatsInterval())
     };
 
     virtual void OnNotify(NOTIFY_TYPE /*notifyType*/) {}
 
+    // Children send log messages through a shared memory ring of recordCount records
+    // (DEFAULT_LOG_RING_RECORDS unless changed) instead of logging them on their own.
+    // The parent drains the ring while it waits for children and passes messages
+    // prefixed with the child index to OnInfo/OnError. A message a child was writing
+    // when it died is dropped, long messages are cut (see ProcessLogRing).
+    // recordCount 0 lets children log directly. Must be called before Create().
+    void EnableLogRing(unsigned int recordCount = DEFAULT_LOG_RING_RECORDS) { mLogRingRecords = recordCount; }
+    static const unsigned int DEFAULT_LOG_RING_RECORDS = 4096;
+
+    // Sample children memory footprint every intervalMilliseconds while the parent
+    // waits for children or posts requests (0 to disable). OnChildMemory() is called
+    // once a child's private memory grows past privateThreshold bytes (0 to disable).
+    void SetMemoryMonitor(int intervalMilliseconds, uint64_t privateThreshold = 0)
+    {
+        mMemoryIntervalNs = (intervalMilliseconds > 0 ? intervalMilliseconds * 1000000ULL : 0);
+        mMemoryThreshold = privateThreshold;
+    }
+
+    // Get the last memory sample of the child (parent only)
+    bool GetChildMemory(int childIndex, ProcessMemoryUsage& usage) const;
+
+    // Read memory footprint of any process
+    static bool ReadMemoryUsage(pid_t pid, ProcessMemoryUsage& usage);
+
+    // Notification sent when a child's private memory grows past the threshold
+    virtual void OnChildMemory(int /*childIndex*/, const ProcessMemoryUsage& /*usage*/) {}
+
+    // Pin every child to a CPU right after fork (see ProcessAffinity::PLACEMENT).
+    // cpuList is used by PLACEMENT::CPU_LIST. If pinParent is true, the parent is
+    // pinned to the allowed CPUs that are not used by children, if any are left,
+    // until children are done. Must be called before Create().
+    void SetPlacement(ProcessAffinity::PLACEMENT placement, const std::vector<int>& cpuList = {}, bool pinParent = false)
+    {
+        mPlacement = placement;
+        mPlacementCpus = cpuList;
+        mPinParent = pinParent;
+    }
+
+    // CPU/I/O scheduling of every child applied right after fork (see ProcessScheduling).
+    // Must be called before Create().
+    void SetScheduling(const ProcessScheduling& scheduling) { mScheduling = scheduling; }
+
+    // Scheduling of childCount children starting at firstChild, e.g. background workers.
+    // It overrides the pool's scheduling, the last added group wins. Must be called before Create().
+    void AddSchedulingGroup(int firstChild, int childCount, const ProcessScheduling& scheduling)
+    {
+        mSchedulingGroups.push_back(SchedulingGroup{firstChild, childCount, scheduling});
+    }
+    void ClearSchedulingGroups() { mSchedulingGroups.clear(); }
+
+    // Children output capture mode
+    enum class OUTPUT_CAPTURE : char
+    {
+        NONE=1,     // Children write directly to the inherited stdout/stderr
+        LINE,       // Parent merges children output line by line
+        CHILD       // Parent writes all output of a child at once when the child is done
+    };
+
+    // Capture children stdout/stderr through pipes and let the parent merge
+    // them with large writes. If prefixLines is true then every line starts
+    // with the child index. Must be called before Create().
+    // Note: The parent reads the pipes only while it waits for children, posts
+    // requests or polls them (ProcessQueue::Post(), WaitFor*()). A parent busy
+    // elsewhere lets the pipes fill up, then children block on their writes.
+    // ProcessQueue children run until Destroy(), so CHILD mode writes out their
+    // output only then.
+    void SetOutputCapture(OUTPUT_CAPTURE mode, bool prefixLines = false)
+    {
+        mOutputCapture = mode;
+        mPrefixOutput = prefixLines;
+    }
+
+    // CPU the child is pinned to (see SetPlacement()), -1 if it isn't pinned
+    int GetChildCpu(int childIndex) const
+    {
+        return (childIndex >= 0 && childIndex < (int)mChildCpus.size() ? mChildCpus[childIndex] : -1);
+    }
+
 protected:
     // Wait for children processes to complete
     bool WaitForAll();
 
     bool IsProcessAlive(pid_t pid);
 
-    // Logging
-    virtual void OnInfo(const std::string& msg) const { /*std::cout << msg << std::endl;*/ }
-    virtual void OnError(const std::string& msg) const { std::cout << msg << std::endl; }
+    // Logging (see ProcessLogger for OnInfo/OnError)
+    void Log(LOG_LEVEL level, const std::string& msg) const override;
+
+    // Pass children log messages from the log ring to OnInfo/OnError (parent only)
+    void DrainLog();
+
+    // Do the parent's periodic work while it waits for children or posts requests:
+    // pass children log messages and output, sample children memory
+    void PollChildren();
+
+    // Sample memory footprint of running children if it's time to (parent only)
+    void SampleMemory();
+
+    // Merge captured children output into the parent's stdout/stderr (parent only).
+    // Unless isFinal is true, pipes are checked at most every OUTPUT_DRAIN_INTERVAL_NS.
+    // The final call (after WaitForAll()) writes out incomplete lines and closes the pipes
+    // of children that are done, pipes of still running children are kept.
+    void DrainOutput(bool isFinal = false);
+
+    // Let the parent run on all the CPUs it had before it was pinned away from children
+    void UnpinParent();
 
     // Child process status enumerator
     enum class CHILD_STATUS : char
@@ -76,6 +191,8 @@ protected:
     {
         pid_t pid = 0;
         CHILD_STATUS status = CHILD_STATUS::NOT_RUNNING;
+        ProcessMemoryUsage memory;              // Last memory sample
+        bool isOverMemoryThreshold = false;     // OnChildMemory() has been called
     };
 
 private:
@@ -99,8 +216,24 @@ private:
     bool CreateCompletionStatusArray(int totalChildren);
     bool DeleteCompletionStatusArray();
 
+    // Create/Delete children log ring in shared memory
+    bool CreateLogRing();
+    void DeleteLogRing();
+
+    // Create/Attach children stdout/stderr pipes
+    bool CreateOutputPipes(int pipes[2][2]);
+    void RedirectOutput(int pipes[2][2]);
+    void AttachOutput(int childIndex, int pipes[2][2]);
+    void CloseOutput();
+    void AppendOutput(int childIndex, int stream, const char* data, size_t len);
+
     bool SetSigAction(int signum, sighandler_t handler, sighandler_t* oldHandler = nullptr);
 
+    // Pin the child to its CPU, pin/unpin the parent away from children
+    void PinChild();
+    void ApplyScheduling();
+    void PinParent();
+
     // Zero-based index of the child process in the order of forking; -1 for the parent
     int mChildIndex = -1;
 
@@ -110,6 +243,48 @@ private:
     // Old (previous) SIGCHLD signal handler
     sighandler_t mOld_SIGCHLD_handler = nullptr;
 
+    // Children log ring in shared memory
+    ProcessLogRing* mLogRing = nullptr;
+    size_t mLogRingSize = 0;
+    unsigned int mLogRingRecords = DEFAULT_LOG_RING_RECORDS;
+
+    // Captured children output: read end of the stdout and stderr
+    // pipes and not yet complete lines for every child
+    struct ChildOutput
+    {
+        int fd[2] = {-1, -1};
+        std::string pending[2];
+    };
+
+    OUTPUT_CAPTURE mOutputCapture = OUTPUT_CAPTURE::NONE;
+    bool mPrefixOutput = false;
+    std::vector<ChildOutput> mChildOutputs;
+    std::string mOutputBuffer[2];   // Merged stdout and stderr waiting to be written
+    uint64_t mOutputDrainNs = 0;    // Last time pipes were checked
+    static const uint64_t OUTPUT_DRAIN_INTERVAL_NS = 10000000; // 10 ms
+
+    // Children placement on CPUs
+    ProcessAffinity::PLACEMENT mPlacement = ProcessAffinity::PLACEMENT::NONE;
+    std::vector<int> mPlacementCpus;    // CPU list of PLACEMENT::CPU_LIST
+    bool mPinParent = false;
+    std::vector<int> mChildCpus;        // CPU of every child
+    std::vector<int> mParentCpus;       // The parent's CPUs before it was pinned
+
+    // Children scheduling
+    struct SchedulingGroup
+    {
+        int firstChild;
+        int childCount;
+        ProcessScheduling scheduling;
+    };
+    ProcessScheduling mScheduling;
+    std::vector<SchedulingGroup> mSchedulingGroups;
+
+    // Children memory monitor
+    uint64_t mMemoryIntervalNs = 0;
+    uint64_t mMemoryThreshold = 0;
+    uint64_t mMemorySampleNs = 0;   // Last time children memory was sampled
+
 protected:
     // Shared memory array that holds children completion status.
     unsigned char* mIsChildDone = nullptr;
@@ -127,22 +302,32 @@ protected:
 //
 #include <sstream>  // std:::stringstream
 
+// Note: Log sites above PROCESS_POOL_LOG_LEVEL don't evaluate their arguments
+//
 #ifndef PROCESS_POOL_INFO
+#if PROCESS_POOL_LOG_LEVEL >= PROCESS_POOL_LOG_INFO
 #define PROCESS_POOL_INFO(msg) \
     do { \
          std::stringstream buf; \
          buf << "[INFO][" << __FILE__ << ":" << __LINE__ << "] " << __func__ << ": " << msg; \
-         OnInfo(buf.str()); \
+         Log(ProcessLogger::LOG_LEVEL::INFO, buf.str()); \
     } while(0);
+#else
+#define PROCESS_POOL_INFO(msg) do {} while(0);
+#endif
 #endif // PROCESS_POOL_INFO
 
 #ifndef PROCESS_POOL_ERROR
+#if PROCESS_POOL_LOG_LEVEL >= PROCESS_POOL_LOG_ERROR
 #define PROCESS_POOL_ERROR(msg) \
     do { \
          std::stringstream buf; \
          buf << "[ERROR][" << __FILE__ << ":" << __LINE__ << "] " << __func__ << ": " << msg; \
-         OnError(buf.str()); \
+         Log(ProcessLogger::LOG_LEVEL::ERROR, buf.str()); \
     } while(0);
+#else
+#define PROCESS_POOL_ERROR(msg) do {} while(0);
+#endif
 #endif // PROCESS_POOL_ERROR
 
 //
@@ -154,13 +339,20 @@ protected:
 #include <sys/stat.h>       // stat
 #include <assert.h>         // assert
 #include <sys/mman.h>       // mmap
+#include <fcntl.h>          // fcntl
 
 inline ProcessPool::~ProcessPool()
 {
     // If we are parent then delete children completion status array
-    // in shared memory (if we have any)
+    // and log ring in shared memory (if we have any)
     if(IsParent())
+    {
         DeleteCompletionStatusArray();
+        DeleteLogRing();
+        DrainOutput(true);
+        CloseOutput();
+        UnpinParent();
+    }
 }
 
 inline bool ProcessPool::PreFork(int totalChildren)
@@ -173,6 +365,15 @@ inline bool ProcessPool::PreFork(int totalChildren)
     // Delete children completion status array since number of children might changes
     DeleteCompletionStatusArray();
 
+    // Drop pipes left by running children of the previous run (if any)
+    CloseOutput();
+
+    // Choose CPUs for children (they pin themselves right after fork).
+    // Note: The placement is based on the parent's CPUs before it was pinned
+    // by the previous run, otherwise new children get the old spare CPUs only
+    UnpinParent();
+    mChildCpus = ProcessAffinity::GetPlacement(mPlacement, totalChildren, mPlacementCpus);
+
     // Ignore the SIGCHLD to prevent children from transforming into
     // zombies so we don't need to wait and reap them.
     if(!SetSigAction(SIGCHLD, SIG_IGN, &mOld_SIGCHLD_handler))
@@ -185,6 +386,11 @@ inline bool ProcessPool::PreFork(int totalChildren)
     {
         PROCESS_POOL_ERROR("Couldn't create children completion status array in shared memory");
     }
+    // Create children log ring in shared memory
+    else if(!CreateLogRing())
+    {
+        PROCESS_POOL_ERROR("Couldn't create children log ring in shared memory");
+    }
     else
     {
         return true; // Success
@@ -204,8 +410,15 @@ inline void ProcessPool::PostFork()
         PROCESS_POOL_ERROR("sigaction(SIGCHLD old) failed because " << errmsg);
     }
 
-    // Delete children completion status array in shared memory (if we have any)
+    // Delete children completion status array and log ring in shared memory (if we have any)
     DeleteCompletionStatusArray();
+    DeleteLogRing();
+
+    // Write out the rest of the captured children output
+    DrainOutput(true);
+
+    // Let the parent run on all its CPUs again
+    UnpinParent();
 }
 
 // Fork totalChildren number of children and wait for them to complete.
@@ -222,6 +435,9 @@ inline bool ProcessPool::Fork(int totalChildren, int maxConcurrentChildren)
     assert(mChildrenPIDs.empty());
     mChildrenPIDs.resize(totalChildren, ChildPID());
 
+    if(mOutputCapture != OUTPUT_CAPTURE::NONE)
+        mChildOutputs.resize(totalChildren);
+
     // Fork child processes...
     int maxChildCount = std::min(totalChildren, maxConcurrentChildren);
     int childCount = 0;  // Number or currently running children
@@ -259,6 +475,14 @@ inline bool ProcessPool::Fork(int totalChildren, int maxConcurrentChildren)
                               << ": we can now fork another child");
         }
 
+        // Create child's stdout/stderr pipes if we capture its output
+        int pipes[2][2] = {{-1, -1}, {-1, -1}};
+        if(mOutputCapture != OUTPUT_CAPTURE::NONE && !CreateOutputPipes(pipes))
+        {
+            result = false;
+            break;
+        }
+
         // Flush all parent's open output streams
         fflush(nullptr);
 
@@ -269,6 +493,7 @@ inline bool ProcessPool::Fork(int totalChildren, int maxConcurrentChildren)
         {
             std::string errmsg = strerror(errno);
             PROCESS_POOL_ERROR("Parent " << mParentPID << " couldn't fork child " << i << " because " << errmsg);
+            AttachOutput(-1, pipes); // Close the pipes
             result = false;
             break;
         }
@@ -276,12 +501,19 @@ inline bool ProcessPool::Fork(int totalChildren, int maxConcurrentChildren)
         {
             // Running as a child.
             mChildIndex = i;
+            RedirectOutput(pipes);
+            PinChild();
+            ApplyScheduling();
             PROCESS_POOL_INFO("Child " << mChildIndex << " (" << getpid() << ") is running");
             return true;
         }
 
         // Running as a parent...
         PROCESS_POOL_INFO("Parent " << mParentPID << " forked child " << i << " (" << childPID << ")");
+        PROCESS_POOL_PROBE2(fork, i, childPID);
+
+        // Read child's output from the pipes
+        AttachOutput(i, pipes);
 
         // Child forking notification - for profiling, etc.
         OnNotify(NOTIFY_TYPE::CHILD_FORK);
@@ -303,6 +535,9 @@ inline bool ProcessPool::Fork(int totalChildren, int maxConcurrentChildren)
     }
     else
     {
+        // Keep the parent away from children CPUs
+        PinParent();
+
         // Post-fork notification - for profiling, etc.
         OnNotify(NOTIFY_TYPE::POST_FORK);
 
@@ -504,6 +739,7 @@ inline pid_t ProcessPool::WaitForOne(bool* isCrashed)
                 // Note: The child might exited or still be idle. But in
                 // either case, it has completed with its task.
                 PROCESS_POOL_INFO("Child " << childIndex << " (" << childPID << ") complete");
+                PROCESS_POOL_PROBE2(wait_for_one, childPID, 0);
                 *isCrashed = false;
                 return childPID;
             }
@@ -517,6 +753,8 @@ inline pid_t ProcessPool::WaitForOne(bool* isCrashed)
                 mChildrenPIDs[childIndex].status = CHILD_STATUS::DONE;
 
                 PROCESS_POOL_ERROR("Child " << childIndex << " (" << childPID << ") is no longer running (crashed or failed)");
+                PROCESS_POOL_PROBE2(child_crash, childIndex, childPID);
+                PROCESS_POOL_PROBE2(wait_for_one, childPID, 1);
                 *isCrashed = true;
                 return childPID;
             }
@@ -533,6 +771,9 @@ inline pid_t ProcessPool::WaitForOne(bool* isCrashed)
         if(crashTestTimer == 0)
             crashTestTimer = CRASH_TEST_INTERVAL;
 
+        // Pass children log messages and output, etc. while we are waiting
+        PollChildren();
+
         // Some children are still running
         usleep(SLEEP_MICROSEC); // sleep for SLEEP_MICROSEC and check again
         crashTestTimer--;
@@ -590,6 +831,489 @@ inline bool ProcessPool::DeleteCompletionStatusArray()
     return result;
 }
 
+inline bool ProcessPool::CreateLogRing()
+{
+    // Clean up first
+    DeleteLogRing();
+
+    if(mLogRingRecords == 0)
+        return true; // Children log by themselves
+
+    size_t len = ProcessLogRing::GetSize(mLogRingRecords);
+    void* addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if(addr == MAP_FAILED)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("mmap for " << len << " bytes failed with error \"" << errmsg << "\"");
+        return false;
+    }
+
+    mLogRing = ProcessLogRing::Create(addr, mLogRingRecords);
+    mLogRingSize = len;
+    return true;
+}
+
+inline void ProcessPool::DeleteLogRing()
+{
+    if(mLogRing == nullptr)
+        return; // Nothing to delete
+
+    // Don't lose messages of children that are gone
+    DrainLog();
+
+    ProcessLogRing* logRing = mLogRing;
+    mLogRing = nullptr; // Log errors directly from now on
+
+    if(::munmap(logRing, mLogRingSize) < 0)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("munmap failed with error \"" << errmsg << "\"");
+    }
+
+    mLogRingSize = 0;
+}
+
+inline void ProcessPool::Log(LOG_LEVEL level, const std::string& msg) const
+{
+    // Children pass messages to the parent if log ring is enabled
+    if(IsChild() && mLogRing)
+        mLogRing->Push(level, mChildIndex, GetMonotonicTimeNs(), msg);
+    else
+        ProcessLogger::Log(level, msg);
+}
+
+inline int ProcessPool::GetAutoProcCount() const
+{
+    int procCount = ProcessLimits::GetProcCount(mMemoryThreshold);
+    PROCESS_POOL_INFO(procCount << " children for " << ProcessLimits::GetAffinityCpuCount() << " CPUs (cgroup limit "
+                      << ProcessLimits::GetCgroupCpuLimit() << ") and " << (ProcessLimits::GetMemoryLimit() >> 20)
+                      << " MB memory limit");
+    return procCount;
+}
+
+inline void ProcessPool::PinChild()
+{
+    if(mChildIndex < 0 || mChildIndex >= (int)mChildCpus.size())
+        return; // No placement
+
+    int cpu = mChildCpus[mChildIndex];
+    if(!ProcessAffinity::SetAffinity({cpu}))
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Child " << mChildIndex << " couldn't be pinned to CPU " << cpu << " because " << errmsg);
+        return;
+    }
+
+    PROCESS_POOL_INFO("Child " << mChildIndex << " (" << getpid() << ") is pinned to CPU " << cpu);
+}
+
+inline void ProcessPool::ApplyScheduling()
+{
+    const ProcessScheduling* scheduling = &mScheduling;
+    for(const SchedulingGroup& group : mSchedulingGroups)
+    {
+        if(mChildIndex >= group.firstChild && mChildIndex < group.firstChild + group.childCount)
+            scheduling = &group.scheduling;
+    }
+
+    if(!scheduling->IsSet())
+        return; // Keep the parent's scheduling
+
+    std::string errmsg;
+    if(!scheduling->Apply(errmsg))
+    {
+        PROCESS_POOL_ERROR("Child " << mChildIndex << " scheduling isn't fully applied because " << errmsg);
+        return;
+    }
+
+    PROCESS_POOL_INFO("Child " << mChildIndex << " scheduling is applied");
+}
+
+inline void ProcessPool::PinParent()
+{
+    if(!mPinParent || mChildCpus.empty() || !mParentCpus.empty())
+        return; // Not required or already pinned
+
+    // CPUs allowed to the parent that no child runs on
+    std::vector<int> allowed, spare;
+    for(const ProcessAffinity::Cpu& cpu : ProcessAffinity::GetCpus())
+    {
+        allowed.push_back(cpu.cpu);
+        if(std::find(mChildCpus.begin(), mChildCpus.end(), cpu.cpu) == mChildCpus.end())
+            spare.push_back(cpu.cpu);
+    }
+
+    if(spare.empty())
+    {
+        PROCESS_POOL_INFO("Parent isn't pinned: children use all " << allowed.size() << " CPUs");
+        return;
+    }
+
+    if(!ProcessAffinity::SetAffinity(spare))
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Parent couldn't be pinned because " << errmsg);
+        return;
+    }
+
+    mParentCpus = allowed;
+    PROCESS_POOL_INFO("Parent is pinned to " << spare.size() << " CPUs not used by children");
+}
+
+inline void ProcessPool::UnpinParent()
+{
+    if(mParentCpus.empty())
+        return; // Not pinned
+
+    if(!ProcessAffinity::SetAffinity(mParentCpus))
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Parent couldn't be unpinned because " << errmsg);
+    }
+    mParentCpus.clear();
+}
+
+inline void ProcessPool::PollChildren()
+{
+    DrainLog();
+    DrainOutput();
+    SampleMemory();
+}
+
+inline void ProcessPool::SampleMemory()
+{
+    if(mMemoryIntervalNs == 0 || IsChild())
+        return; // Memory monitor is disabled
+
+    uint64_t nowNs = GetMonotonicTimeNs();
+    if(nowNs - mMemorySampleNs < mMemoryIntervalNs)
+        return; // Not a good time to sample
+    mMemorySampleNs = nowNs;
+
+    int childIndex = 0;
+    for(ChildPID& child : mChildrenPIDs)
+    {
+        if(child.status == CHILD_STATUS::NOT_RUNNING || !ReadMemoryUsage(child.pid, child.memory))
+        {
+            childIndex++;
+            continue; // The child is not running or has just exited
+        }
+
+        // Notify once the child crosses the threshold (and again if it goes down and up)
+        bool isOver = (mMemoryThreshold && child.memory.GetPrivate() > mMemoryThreshold);
+        if(isOver && !child.isOverMemoryThreshold)
+        {
+            PROCESS_POOL_INFO("Child " << childIndex << " (" << child.pid << ") private memory "
+                              << child.memory.GetPrivate() << " bytes exceeds " << mMemoryThreshold << " bytes");
+            OnChildMemory(childIndex, child.memory);
+        }
+        child.isOverMemoryThreshold = isOver;
+        childIndex++;
+    }
+}
+
+inline bool ProcessPool::GetChildMemory(int childIndex, ProcessMemoryUsage& usage) const
+{
+    if(childIndex < 0 || childIndex >= (int)mChildrenPIDs.size())
+        return false;
+
+    usage = mChildrenPIDs[childIndex].memory;
+    return (usage.sampleTimeNs != 0);
+}
+
+inline bool ProcessPool::ReadMemoryUsage(pid_t pid, ProcessMemoryUsage& usage)
+{
+    char path[64]{};
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+
+    ProcessMemoryUsage sample;
+    FILE* file = fopen(path, "r");
+    if(file)
+    {
+        static const struct { const char* name; uint64_t ProcessMemoryUsage::* field; } fields[] =
+        {
+            { "Rss:", &ProcessMemoryUsage::rss },
+            { "Pss:", &ProcessMemoryUsage::pss },
+            { "Shared_Clean:", &ProcessMemoryUsage::sharedClean },
+            { "Shared_Dirty:", &ProcessMemoryUsage::sharedDirty },
+            { "Private_Clean:", &ProcessMemoryUsage::privateClean },
+            { "Private_Dirty:", &ProcessMemoryUsage::privateDirty },
+            { "Swap:", &ProcessMemoryUsage::swap }
+        };
+
+        // Lines look like "Private_Dirty:       100 kB"
+        char line[256]{};
+        while(fgets(line, sizeof(line), file))
+        {
+            for(const auto& field : fields)
+            {
+                size_t len = strlen(field.name);
+                if(strncmp(line, field.name, len) == 0)
+                {
+                    sample.*field.field = strtoull(line + len, nullptr, 10) * 1024;
+                    break;
+                }
+            }
+        }
+        fclose(file);
+    }
+    else
+    {
+        // No smaps_rollup (kernel before 4.14): resident and shared pages only
+        snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+        file = fopen(path, "r");
+        if(!file)
+            return false; // The process is gone
+
+        unsigned long long size = 0, resident = 0, shared = 0;
+        int count = fscanf(file, "%llu %llu %llu", &size, &resident, &shared);
+        fclose(file);
+        if(count != 3)
+            return false;
+
+        uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        sample.rss = resident * pageSize;
+        sample.sharedClean = shared * pageSize;
+        sample.privateDirty = (resident > shared ? resident - shared : 0) * pageSize;
+    }
+
+    sample.sampleTimeNs = GetMonotonicTimeNs();
+    usage = sample;
+    return true;
+}
+
+inline void ProcessPool::DrainLog()
+{
+    if(!mLogRing || IsChild())
+        return;
+
+    ProcessLogRing::Record record;
+    while(mLogRing->Pop(record))
+        ProcessLogger::Log(record.level, "[" + std::to_string(record.childIndex) + "] " + record.msg);
+
+    uint64_t dropped = mLogRing->GetDropped();
+    if(dropped)
+    {
+        PROCESS_POOL_ERROR("Children log ring is full, " << dropped << " messages dropped");
+    }
+}
+
+inline bool ProcessPool::CreateOutputPipes(int pipes[2][2])
+{
+    for(int stream = 0; stream < 2; stream++)
+    {
+        if(pipe(pipes[stream]) < 0)
+        {
+            std::string errmsg = strerror(errno);
+            PROCESS_POOL_ERROR("pipe failed with error \"" << errmsg << "\"");
+
+            if(stream == 1)
+            {
+                close(pipes[0][0]);
+                close(pipes[0][1]);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Running as a child: send stdout/stderr into the pipes
+inline void ProcessPool::RedirectOutput(int pipes[2][2])
+{
+    // Close the parent's read ends of the siblings' pipes
+    for(ChildOutput& output : mChildOutputs)
+    {
+        for(int stream = 0; stream < 2; stream++)
+        {
+            if(output.fd[stream] >= 0)
+                close(output.fd[stream]);
+        }
+    }
+    mChildOutputs.clear();
+
+    if(pipes[0][0] < 0)
+        return; // Output is not captured
+
+    for(int stream = 0; stream < 2; stream++)
+    {
+        dup2(pipes[stream][1], stream + 1 /*STDOUT_FILENO or STDERR_FILENO*/);
+        close(pipes[stream][0]);
+        close(pipes[stream][1]);
+    }
+}
+
+// Running as a parent: keep the read ends of the child's pipes
+inline void ProcessPool::AttachOutput(int childIndex, int pipes[2][2])
+{
+    if(pipes[0][0] < 0)
+        return; // Output is not captured
+
+    const int PIPE_SIZE = 1024 * 1024; // Let a child write ahead while the parent is busy
+
+    for(int stream = 0; stream < 2; stream++)
+    {
+        close(pipes[stream][1]);
+
+        if(childIndex < 0 || childIndex >= (int)mChildOutputs.size())
+        {
+            close(pipes[stream][0]);
+            continue;
+        }
+
+        fcntl(pipes[stream][0], F_SETFL, fcntl(pipes[stream][0], F_GETFL) | O_NONBLOCK);
+#ifdef F_SETPIPE_SZ
+        fcntl(pipes[stream][0], F_SETPIPE_SZ, PIPE_SIZE); // Best effort
+#endif
+        mChildOutputs[childIndex].fd[stream] = pipes[stream][0];
+    }
+}
+
+inline void ProcessPool::DrainOutput(bool isFinal /*= false*/)
+{
+    if(mChildOutputs.empty() || IsChild())
+        return;
+
+    // Don't check pipes too often (Post() calls us for every request)
+    uint64_t nowNs = GetMonotonicTimeNs();
+    if(!isFinal && nowNs - mOutputDrainNs < OUTPUT_DRAIN_INTERVAL_NS)
+        return;
+    mOutputDrainNs = nowNs;
+
+    char buf[64 * 1024];
+    int childCount = (int)mChildOutputs.size();
+
+    for(int childIndex = 0; childIndex < childCount; childIndex++)
+    {
+        ChildOutput& output = mChildOutputs[childIndex];
+        bool isRunning = (childIndex < (int)mChildrenPIDs.size() && mChildrenPIDs[childIndex].status == CHILD_STATUS::RUNNING);
+
+        for(int stream = 0; stream < 2; stream++)
+        {
+            // Read whatever the child has written so far
+            while(output.fd[stream] >= 0)
+            {
+                ssize_t len = read(output.fd[stream], buf, sizeof(buf));
+                if(len > 0)
+                {
+                    output.pending[stream].append(buf, len);
+                }
+                else if(len < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                else
+                {
+                    // Close the pipe if the child has exited (or is done on the final call)
+                    if(len == 0 || (isFinal && !isRunning))
+                    {
+                        close(output.fd[stream]);
+                        output.fd[stream] = -1;
+                    }
+                    break;
+                }
+            }
+        }
+
+        bool isChildDone = (output.fd[0] < 0 && output.fd[1] < 0);
+
+        for(int stream = 0; stream < 2; stream++)
+        {
+            // Pass complete lines only, unless we wait for the child to be done
+            std::string& pending = output.pending[stream];
+            if(isChildDone)
+            {
+                AppendOutput(childIndex, stream, pending.data(), pending.size());
+                pending.clear();
+            }
+            else if(mOutputCapture == OUTPUT_CAPTURE::LINE)
+            {
+                size_t pos = pending.rfind('\n');
+                if(pos != std::string::npos)
+                {
+                    AppendOutput(childIndex, stream, pending.data(), pos + 1);
+                    pending.erase(0, pos + 1);
+                }
+            }
+        }
+    }
+
+    // Write merged output in large chunks
+    for(int stream = 0; stream < 2; stream++)
+    {
+        std::string& buffer = mOutputBuffer[stream];
+        if(buffer.empty())
+            continue;
+
+        // Keep the order with the parent's own output
+        fflush(stream == 0 ? stdout : stderr);
+
+        size_t written = 0;
+        while(written < buffer.size())
+        {
+            ssize_t len = write(stream + 1 /*STDOUT_FILENO or STDERR_FILENO*/,
+                                buffer.data() + written, buffer.size() - written);
+            if(len < 0 && errno == EINTR)
+                continue;
+            if(len <= 0)
+                break; // Nothing we can do about it
+            written += len;
+        }
+        buffer.clear();
+    }
+
+    if(isFinal)
+    {
+        // Keep the outputs of running children
+        bool isAllClosed = true;
+        for(const ChildOutput& output : mChildOutputs)
+            isAllClosed = isAllClosed && output.fd[0] < 0 && output.fd[1] < 0;
+        if(isAllClosed)
+            mChildOutputs.clear();
+    }
+}
+
+inline void ProcessPool::CloseOutput()
+{
+    for(ChildOutput& output : mChildOutputs)
+    {
+        for(int stream = 0; stream < 2; stream++)
+        {
+            if(output.fd[stream] >= 0)
+                close(output.fd[stream]);
+            output.fd[stream] = -1;
+        }
+    }
+    mChildOutputs.clear();
+}
+
+inline void ProcessPool::AppendOutput(int childIndex, int stream, const char* data, size_t len)
+{
+    std::string& buffer = mOutputBuffer[stream];
+    if(!mPrefixOutput)
+    {
+        buffer.append(data, len);
+        return;
+    }
+
+    std::string prefix = "[" + std::to_string(childIndex) + "] ";
+    const char* end = data + len;
+    while(data < end)
+    {
+        const char* eol = (const char*)memchr(data, '\n', end - data);
+        const char* next = (eol ? eol + 1 : end);
+
+        buffer.append(prefix);
+        buffer.append(data, next - data);
+        if(!eol)
+            buffer.push_back('\n'); // Incomplete last line of the child's output
+        data = next;
+    }
+}
+
 inline bool ProcessPool::SetSigAction(int signum, sighandler_t handler, sighandler_t* oldHandler /*= nullptr*/)
 {
     struct sigaction sa, old_sa;
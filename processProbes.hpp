@@ -0,0 +1,39 @@
+//
+// processProbes.hpp
+//
+#ifndef _PROCESS_PROBES_HPP_
+#define _PROCESS_PROBES_HPP_
+
+//
+// USDT static tracepoints for perf/bpftrace (provider "process_pool"), e.g.
+//   bpftrace -e 'usdt:./app:process_pool:request_done { @[arg0] = hist(arg2); }'
+//
+// Every probe compiles into a single nop instruction plus an ELF note,
+// so it costs nothing until a tracer attaches to it. The probes are
+// available if <sys/sdt.h> is installed (systemtap-sdt-dev/devel package).
+// Define PROCESS_POOL_NO_USDT to compile them out completely.
+//
+// Probes and their arguments:
+//   fork(childIndex, pid)                      Parent forked a child
+//   wait_for_one(pid, isCrashed)               Parent detected a completed child
+//   child_crash(childIndex, pid)               Parent detected a crashed child
+//   post(requestId, queueDepth)                Parent posted a request
+//   dequeue(childIndex, requestId, postNs)     Child picked up a request
+//   request_start(childIndex, requestId)       Child started request routine
+//   request_done(childIndex, requestId, serviceNs)
+//   free_request(childIndex, requestId)        Child released a request
+//
+#if !defined(PROCESS_POOL_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROCESS_POOL_PROBE2(name, a1, a2) DTRACE_PROBE2(process_pool, name, a1, a2)
+#define PROCESS_POOL_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(process_pool, name, a1, a2, a3)
+#endif
+#endif
+
+#ifndef PROCESS_POOL_PROBE2
+#define PROCESS_POOL_PROBE2(name, a1, a2) do {} while(0)
+#define PROCESS_POOL_PROBE3(name, a1, a2, a3) do {} while(0)
+#endif
+
+#endif // _PROCESS_PROBES_HPP_
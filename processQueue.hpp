@@ -9,7 +9,16 @@
 #include <iostream>         // std::cout
 #include <sys/mman.h>       // mmap()
 #include <time.h>           // time()
+#include <vector>           // std::vector
+#include <type_traits>      // std::is_trivially_copyable
+#include <algorithm>        // std::min(), std::max()
 #include "processPool.hpp"
+#include "processRcu.hpp"
+#include "processStats.hpp"
+#include "processTrace.hpp"
+#include "processPerf.hpp"
+#include "processCapture.hpp"
+#include "processLimits.hpp"
 
 //
 // Utility class to create queue of worker processes
@@ -17,24 +26,40 @@
 template<class ARGS>
 class ProcessQueue : public ProcessPool
 {
+protected:
     // Helper class to lock/unlock QueueLock
     class QueueLock
     {
     public:
-        QueueLock(unsigned char& lock, int waitMilliseconds=5000 /*5 sec*/) : mLock(lock)
+        QueueLock(unsigned char& lock, ProcessStatsSection* stats = nullptr,
+                  int waitMilliseconds=5000 /*5 sec*/) : mLock(lock)
         {
             int waitUseconds = waitMilliseconds * 1000;
+            uint64_t waitStartNs = 0;
             while(waitUseconds > 0)
             {
                 if(__sync_fetch_and_or(&mLock, (unsigned char)0xff) == 0)
                     break;
 
+                // Only measure the time if we have to wait
+                if(stats && !waitStartNs)
+                    waitStartNs = GetMonotonicTimeNs();
+
                 // Use a simple Ethernet-style delay algorithm to avoid collisions.
                 int delay = (random() & 0x3) * 1000; // 0-3 ms delay
                 usleep(delay);
                 waitUseconds -= delay;
             }
             mHasLock = (waitUseconds > 0);
+
+            if(waitStartNs)
+            {
+                stats->BeginUpdate();
+                ProcessStatsSection::Add(stats->stats.lockWaitNs, GetMonotonicTimeNs() - waitStartNs);
+                ProcessStatsSection::Add(stats->stats.lockContended, 1);
+                ProcessStatsSection::Add(stats->stats.lockFailures, mHasLock ? 0 : 1);
+                stats->EndUpdate();
+            }
         }
         ~QueueLock()
         {
@@ -56,10 +81,11 @@ public:
     // Note: maxRequestCount represents the worst case scenario
     // when processing is slow and all requests must be stored
     // in Request Queue while waiting for being processed.
+    // AUTO_REQUEST_COUNT sizes the queue by the memory limit at Create() (see ProcessLimits::GetRequestCount()).
     ProcessQueue(unsigned int maxRequestCount = 1000000)
     {
         mWaitForAll = false;
-        mRequestQueueSize = (maxRequestCount ? sizeof(Node) * maxRequestCount + sizeof(RequestQueue) : 0);
+        mMaxRequestCount = maxRequestCount;
     }
     virtual ~ProcessQueue() { Destroy(); }
 
@@ -67,55 +93,392 @@ public:
     ProcessQueue(const ProcessQueue&) = delete;
     ProcessQueue& operator=(const ProcessQueue&) = delete;
 
+    static const unsigned int AUTO_REQUEST_COUNT = UINT_MAX;
+
     // Fork procCount number of child processes and DON'T wait for them to complete.
-    bool Create(int procCount, void (*fptr)(const ARGS&));
+    // Broadcast messages are processed by broadcastFptr, or by fptr if it's not set.
+    // AUTO_PROC_COUNT sizes the pool by the CPUs and memory available (see GetAutoProcCount()).
+    bool Create(int procCount, void (*fptr)(const ARGS&), void (*broadcastFptr)(const ARGS&) = nullptr);
 
-    // Add request to RequestQueue
+    // Add request to RequestQueue (NUMA nodes take turns, see EnableNuma())
     bool Post(const ARGS& args);
 
+    // Add request of the tenant (see SetTenantCount()) with its expected cost (see EnableCostScheduling())
+    bool PostToTenant(const ARGS& args, unsigned int tenant, uint64_t estimatedCost = 0);
+
+    // Keep requests of tenantCount tenants (0 - tenantCount-1) in separate queues served
+    // by deficit round robin, so a burst of one tenant can't take over all children.
+    // Requests of every tenant are still served in order. Must be called before Create().
+    bool SetTenantCount(unsigned int tenantCount);
+
+    // Every turn the tenant may take up to weight * dequeue batch requests (1 by default),
+    // so weights are shares of children time while tenants have requests. Up to maxRunning
+    // requests of the tenant are processed at once (0 for no limit), the rest of children
+    // serve other tenants. May be changed at any time.
+    // Note: A child that crashes while processing a request of the tenant holds its slot.
+    bool SetTenant(unsigned int tenant, unsigned int weight, unsigned int maxRunning = 0);
+
+    // Let idle children run a duplicate of a request that has been processed longer than
+    // the percentile (e.g. 99) of service times observed so far. The copy that finishes
+    // first counts as the request, the other one is cancelled (see IsCancelled()).
+    // Note: The queue doesn't discard anything of the losing copy, its handler has to
+    // poll IsCancelled() to stop and drop its output. Otherwise both copies run to the end.
+    // Both copies record their service time and take a slot of the tenant's maxRunning,
+    // a request isn't hedged while its tenant is at the cap.
+    // Handlers must be idempotent. 0 disables hedging. May be changed at any time.
+    // Note: Requests must be trivially copyable, children copy them from each other.
+    void SetHedging(double percentile);
+
+    // Is the request the calling child processes no longer needed because its other
+    // copy has finished first (see SetHedging())? Handlers check it to stop early and
+    // drop their output, it's the only way the output of the losing copy is discarded.
+    bool IsCancelled() const;
+
+    // Dispatch requests of every tenant by their cost, the most expensive first (longest
+    // processing time first), so big requests posted last don't stretch the batch while
+    // other children are idle. Costs are grouped by powers of two, requests of the same
+    // group keep their order. If getType is set, the cost of each of typeCount request
+    // types is learned from service times (in nanoseconds) and used instead of estimatedCost
+    // once the type has been processed, so hints should be in nanoseconds too.
+    // Requests posted without a cost (and of types not learned yet) are the cheapest.
+    // Note: Cost groups are served strictly, the most expensive first: a steady stream
+    // of expensive requests starves cheaper requests of the same tenant. It's meant for
+    // batches drained by WaitForCompletion(), not for latency sensitive traffic.
+    // Must be called before Create().
+    bool EnableCostScheduling(unsigned int (*getType)(const ARGS&) = nullptr, unsigned int typeCount = 0);
+
+    // Status of the last Post(), PostToNode() or PostToTenant() call
+    enum class POST_STATUS : char
+    {
+        OK=1,       // The request is queued
+        FAILED,     // The queue is out of memory or its lock is not available
+        SHED        // The queue is overloaded (see SetShedding())
+    };
+    POST_STATUS GetPostStatus() const { return mPostStatus; }
+
+    // Shed requests at Post() with POST_STATUS::SHED once the queue wait (the time
+    // requests wait for a child) stays above targetMilliseconds for intervalMilliseconds,
+    // until children find the queue wait below the target or the queue empty (CoDel-style).
+    // Only requests isSheddable() returns true for are shed, all if it's not set.
+    // targetMilliseconds 0 disables shedding. May be changed at any time.
+    void SetShedding(int targetMilliseconds, int intervalMilliseconds = 100, bool (*isSheddable)(const ARGS&) = nullptr);
+
+    // Add request with its expected cost (see EnableCostScheduling())
+    bool Post(const ARGS& args, uint64_t estimatedCost);
+
+    // Add request to the sub-queue of the NUMA node that owns its data
+    // with its expected cost (see EnableCostScheduling())
+    bool PostToNode(const ARGS& args, int numaNode, uint64_t estimatedCost = 0);
+
+    // Split Request Queue into one sub-queue per NUMA node (see ProcessAffinity::GetNodes())
+    // allocated in the node's memory. Children are spread over nodes and pinned to the node
+    // CPUs (unless SetPlacement() pins them to a CPU), they serve requests of their node and
+    // take requests of other nodes only when their node has none. Every node holds up to
+    // maxRequestCount requests. Must be called before Create().
+    bool EnableNuma(bool enable = true);
+
+    // Let every child take up to count requests from the queue at once (1 by default).
+    // Bigger batches take the queue lock less often, but requests of a batch can't be
+    // picked up by idle children. Shared data and broadcast messages are picked up
+    // between batches. May be changed at any time.
+    void SetDequeueBatch(unsigned int count);
+    unsigned int GetDequeueBatch() const { return mDequeueBatch; }
+
+    // Find the number of children (up to maxProcCount, bounded by ProcessLimits::GetCpuLimit())
+    // and dequeue batch size that serve calibration requests best. The fastest configuration
+    // wins, preferring lower p99 latency among configurations within 5% of its throughput.
+    // If apply is true, create the queue with the best configuration.
+    // Note: Calibration should take at least ~100 ms, completion is polled every 10 ms.
+    bool Tune(const std::vector<ARGS>& calibration, void (*fptr)(const ARGS&), ProcessTuneResult& best,
+              bool apply = true, int maxProcCount = 0, void (*broadcastFptr)(const ARGS&) = nullptr);
+
+    // Get all configurations measured by the last Tune() call
+    const std::vector<ProcessTuneResult>& GetTuneResults() const { return mTuneResults; }
+
+    // Send message to every running child process. Children process it between requests.
+    // Wait up to waitMilliseconds if children haven't processed previous messages yet.
+    bool Broadcast(const ARGS& msg, int waitMilliseconds = 5000);
+
+    // Wait up to waitMilliseconds for all running child processes to process all broadcast
+    // messages. Crashed children are not waited for. Returns false on timeout.
+    bool WaitForBroadcast(int waitMilliseconds = 5000);
+
+    // Register shared data that children pick up between requests. Create() fails if
+    // the data is created for fewer readers than children. Must be called before Create().
+    bool AddRcu(ProcessRcuBase& rcu);
+
     // Wait for Request Queue became empty
     bool WaitForCompletion();
 
     // Destroy Request Queue and terminate all child processes
     void Destroy();
 
+    // Get consistent snapshot of the queue and children statistics (parent only)
+    bool Snapshot(ProcessQueueStats& stats);
+
+    // Merge latency histograms of all children (parent only)
+    bool GetLatency(ProcessQueueLatency& latency);
+
+    // Open perf counters (task clock, context switches, page faults, cycles and
+    // instructions) in every child right after fork. Must be called before Create().
+    void EnablePerfCounters(bool enable = true) { mEnablePerf = enable; }
+
+    // Get statistics of the last batch: the difference between the last
+    // two WaitForCompletion() calls (or Create() for the very first batch)
+    const ProcessQueueStats& GetBatchStats() const { return mBatchStats; }
+
+    // Record parent and children activity into eventsPerChild ring buffers.
+    // Only every sampleRate-th request is traced. Must be called before Create().
+    bool EnableTracing(unsigned int eventsPerChild = 65536, unsigned int sampleRate = 1);
+
+    // Write recorded activity into Chrome trace-event JSON file (parent only)
+    bool WriteTrace(const std::string& path);
+
+    // Record every posted request (post time, bytes, tenant, cost hint and NUMA node) into a binary log (parent only)
+    bool StartCapture(const std::string& path);
+    void StopCapture() { mCapture.Close(); }
+
+    // Post requests from a capture log keeping their original inter-arrival times
+    // divided by speed (0 to post as fast as possible) and wait for completion.
+    // Every request is posted the way it was captured (PostToNode(), PostToTenant() or Post()).
+    bool Replay(const std::string& path, double speed = 1.0);
+
+    // Send NOTIFY_TYPE::STATS notification every milliseconds (0 to disable).
+    // Note: The parent checks the timer when it posts or waits for requests.
+    void SetStatsInterval(int milliseconds) { mStatsIntervalNs = (milliseconds > 0 ? milliseconds * 1000000ULL : 0); }
+
+protected:
+    // Request Queue lock of the subQueue-th sub-queue (e.g. for fault injection, see bench/benchFault.cpp)
+    unsigned char& GetQueueLock(size_t subQueue)
+    {
+        assert(subQueue < mSubQueues.size());
+        return mSubQueues[subQueue]->lock;
+    }
+
 private:
     struct Node : public ARGS
     {
         Node* next{nullptr};
+        uint64_t postNs{0};     // Monotonic time the request was posted
+        uint64_t id{0};         // Sequence number of the request
+        unsigned int tenant{0};
     };
 
-    Node* GetNextRequest();
-    void FreeRequest(Node* node);
-    bool CreateRequestQueue();
+    // Detach up to dequeueBatch requests chained with next from the child's own
+    // sub-queue or, if it's empty, from another one
+    Node* GetNextRequest(size_t& subQueueIndex);
+    void FreeRequest(Node* node, size_t subQueueIndex);   // Free the whole chain
+    void AttachNumaNode();
+    void UpdateOverload(uint64_t queueWaitNs, uint64_t nowNs);
+    bool PostRequest(const ARGS& args, size_t subQueueIndex, unsigned int tenant, uint64_t cost = 0, int numaNode = -1);
+    unsigned int GetCostGroup(const ARGS& args, uint64_t cost) const;
+    void LearnCost(const ARGS& args, uint64_t serviceNs);
+    unsigned int AcquireTenant(unsigned int tenant, unsigned int count);
+    void ReleaseTenant(unsigned int tenant, bool isCompleted = true);
+    void BeginRun(const Node& node, uint64_t startNs);
+    bool EndRun();
+    bool HedgeRequest(uint64_t& markNs);
+    static void CopyRunArgs(ARGS& dst, const ARGS& src);
+    uint64_t GetHedgeThreshold();
+    void ProcessBroadcasts();
+    uint64_t GetBroadcastAck();
+    bool CreateRequestQueue(int procCount);
+    unsigned int GetMaxRequestCount() const;
     void DeleteRequestQueue();
     bool HasCrashedChildren();
+    void CheckStatsTimer();
+    bool IsTraced(uint64_t id) const { return (mTraceSampleRate && id % mTraceSampleRate == 0); }
+    void PublishPerfCounters(ProcessStatsSection& stats);
+    ProcessStatsSection* GetStatsSection() { return (IsChild() ? &mChildInfo[GetChildIndex()].stats : &mParentStats); }
 
     // Class data
-    struct RequestQueue
+    static const unsigned int BROADCAST_RING_SIZE = 16;
+
+    // FIFO of requests
+    struct RequestList
     {
-        unsigned char lock{0};
-        unsigned char* fillPtr{nullptr};
         Node* head{nullptr};
         Node* tail{nullptr};
+    };
+
+    // Requests of one tenant in a sub-queue: a list per cost group (see EnableCostScheduling())
+    struct TenantQueue
+    {
+        RequestList* lists{nullptr};                // mCostGroups lists, the most expensive last
+        uint64_t nonEmpty{0};                       // Bit of every list that has requests
+        uint64_t deficit{0};                        // Requests the tenant may take in its turn
+    };
+
+    // Requests of one NUMA node (the only sub-queue unless NUMA mode is enabled).
+    // Note: The sub-queue is followed by its tenant queues and nodes in the same NUMA node's memory
+    struct alignas(64) SubQueue
+    {
+        unsigned char lock{0};
+        unsigned char* fillPtr{nullptr};
+        unsigned char* endPtr{nullptr};
+        TenantQueue* tenants{nullptr};              // mTenantCount queues
+        unsigned int tenant{0};                     // Tenant whose turn it is
+        uint64_t depth{0};
         Node* free{nullptr};
+        int numaNode{-1};                           // -1 if NUMA mode is disabled
+    };
+
+    // Tenant settings and counters shared by all sub-queues
+    struct alignas(64) TenantInfo
+    {
+        unsigned int weight{1};
+        unsigned int maxRunning{0};                 // 0 if not limited
+        uint64_t running{0};                        // Updated by children atomically
+        uint64_t posted{0};                         // Updated by the parent
+        uint64_t completed{0};                      // Updated by children atomically
+    };
+
+    // Learned cost of a request type (see EnableCostScheduling())
+    struct TypeCost
+    {
+        uint64_t costNs{0};                         // Moving average of service times
+        uint64_t samples{0};
+    };
+    static const unsigned int COST_GROUPS = 64;     // Costs are grouped by powers of two
+
+    Node* DetachRequests(SubQueue& subQueue);
+
+    // Note: Keep children info aligned to the cache line
+    struct alignas(64) RequestQueue
+    {
         bool stop{false};
         bool hasMore{true};
+        unsigned int dequeueBatch{1};               // Requests a child takes at once
+        uint64_t shedTargetNs{0};                   // Queue wait target, 0 if shedding is disabled
+        uint64_t shedIntervalNs{0};
+        uint64_t overloadNs{0};                     // Time the queue wait went over the target for the interval
+        bool isOverloaded{false};                   // Shed requests (updated by children)
+        double hedgePercentile{0};                  // 0 if hedging is disabled
+        uint64_t hedgeThresholdNs{0};               // Service time to hedge after
+        uint64_t hedgeUpdateNs{0};                  // Time the threshold was updated
+        uint64_t broadcastSeq{0};                   // Number of broadcast messages sent
+        ARGS broadcastRing[BROADCAST_RING_SIZE];    // Last BROADCAST_RING_SIZE messages
+
+        // Queue statistics (updated by the parent, depth is atomic)
+        uint64_t posted{0};
+        uint64_t postFailures{0};
+        uint64_t shed{0};
+        uint64_t depth{0};
+        uint64_t maxDepth{0};
+        uint64_t crashes{0};
+    };
+
+    // Child process info in shared memory (one per child)
+    struct ChildInfo
+    {
+        ProcessStatsSection stats;  // Updated by the child only
+        uint64_t broadcastAck{0};   // Number of broadcast messages processed by the child
+        ProcessQueueLatency latency;
+
+        // Request the child processes to be hedged by idle children (see SetHedging())
+        uint64_t runState{0};       // Sequence number of the child's request << 2 | RUN_STATE
+        uint64_t runStartNs{0};
+        uint64_t runPostNs{0};
+        uint64_t runId{0};
+        unsigned int runTenant{0};
+        ARGS runArgs;
     };
 
+    // Request run states
+    static const uint64_t RUN_IDLE = 0;         // The child doesn't process a request
+    static const uint64_t RUN_ORIGINAL = 1;     // The child processes a request
+    static const uint64_t RUN_HEDGED = 2;       // ... and another child processes its copy
+    static const uint64_t RUN_HEDGE_WON = 3;    // The copy has finished first
+    static const uint64_t RUN_STATE_MASK = 3;
+    static const unsigned int MIN_HEDGE_SAMPLES = 100;              // Service times to know the percentile
+    static const uint64_t HEDGE_UPDATE_INTERVAL_NS = 100000000;     // 100 ms
+
     RequestQueue* mRequestQueue{nullptr};
+    ChildInfo* mChildInfo{nullptr};
+    TenantInfo* mTenantInfo{nullptr};
+    unsigned int mTenantCount{1};
+    std::vector<TenantInfo> mTenantSettings;        // Settings to apply on Create()
+    unsigned int mCostGroups{1};                    // COST_GROUPS if cost scheduling is enabled
+    unsigned int (*mGetType)(const ARGS&){nullptr};
+    unsigned int mTypeCount{0};
+    TypeCost* mTypeCosts{nullptr};                  // Learned cost of every request type
+    std::vector<SubQueue*> mSubQueues;
     size_t mRequestQueueSize{0};
+    bool mEnableNuma{false};
+    std::vector<ProcessAffinity::Node> mNumaNodes;  // NUMA node of every sub-queue
+    size_t mSubQueueIndex{0};               // Child's own sub-queue
+    size_t mPostIndex{0};                   // Next sub-queue for Post()
+    unsigned int mMaxRequestCount{0};
+    unsigned int mDequeueBatch{1};
+    POST_STATUS mPostStatus{POST_STATUS::OK};
+    double mHedgePercentile{0};
+    size_t mChildInfoCount{0};
+    uint64_t mRunSeq{0};                    // Child's request sequence number
+    int mHedgeChild{-1};                    // Child whose request the child hedges, -1 if none
+    uint64_t mHedgeState{0};                // Run state of the hedged request
+    uint64_t mShedTargetNs{0};
+    uint64_t mShedIntervalNs{0};
+    bool (*mIsSheddable)(const ARGS&){nullptr};
+    bool mIsShedding{false};                // The parent sheds requests
+    std::vector<ProcessTuneResult> mTuneResults;
+    void (*mRequestFptr)(const ARGS&){nullptr};
+    void (*mBroadcastFptr)(const ARGS&){nullptr};
+    std::vector<ProcessRcuBase*> mRcuList;
+    ProcessStatsSection mParentStats;       // Parent's lock counters
+    uint64_t mStatsIntervalNs{0};
+    uint64_t mStatsTimerNs{0};
+    ProcessTrace mTrace;
+    unsigned int mTraceEvents{0};
+    unsigned int mTraceSampleRate{0};
+    unsigned int mTraceParentIndex{0};      // Parent's trace buffer follows children's ones
+    bool mEnablePerf{false};
+    ProcessPerfCounters mPerfCounters;      // Child's own counters
+    ProcessQueueStats mBatchStats;          // Last batch statistics
+    ProcessQueueStats mCompletionStats;     // Statistics at the last WaitForCompletion()
+    ProcessCapture mCapture;                // Log of posted requests
     size_t mCrashTestTimer{0};
     const unsigned int CRASH_TEST_INTERVAL{1};   // How often to check for crashed children
 };
 
 // Fork procCount number of child processes and DON'T wait for them to complete.
 template<class ARGS>
-bool ProcessQueue<ARGS>::Create(int procCount, void (*fptr)(const ARGS&))
+bool ProcessQueue<ARGS>::Create(int procCount, void (*fptr)(const ARGS&),
+                                void (*broadcastFptr)(const ARGS&) /*= nullptr*/)
 {
-    if(!CreateRequestQueue())
+    mRequestFptr = fptr;
+    mBroadcastFptr = (broadcastFptr ? broadcastFptr : fptr);
+
+    if(procCount == AUTO_PROC_COUNT)
+        procCount = GetAutoProcCount();
+
+    // Every child needs its own reader slot of the shared data
+    for(ProcessRcuBase* rcu : mRcuList)
+    {
+        if(rcu->GetReaderCount() < procCount)
+        {
+            PROCESS_POOL_ERROR("Shared data is created for " << rcu->GetReaderCount() << " readers, but there are "
+                               << procCount << " children");
+            return false;
+        }
+    }
+
+    // Note: NUMA nodes and placement are based on all the parent's CPUs
+    UnpinParent();
+
+    if(!CreateRequestQueue(procCount))
         return false;
 
+    if(mTraceEvents)
+    {
+        mTraceParentIndex = (procCount > 0 ? procCount : 0);
+        if(!mTrace.Create(mTraceParentIndex + 1, mTraceEvents))
+        {
+            DeleteRequestQueue();
+            return false;
+        }
+        mTrace.Attach(mTraceParentIndex, "parent");
+    }
+
     // Create process pool with procCount number of children processes
     // but don't wait for them to complete.
     if(!ProcessPool::Create(procCount))
@@ -128,32 +491,128 @@ bool ProcessQueue<ARGS>::Create(int procCount, void (*fptr)(const ARGS&))
     if(IsParent())
     {
         mCrashTestTimer = time(nullptr);
+        mStatsTimerNs = GetMonotonicTimeNs();
+        Snapshot(mCompletionStats);
         return true;
     }
 
+    // Open child's perf counters right after fork
+    if(mEnablePerf && !mPerfCounters.Open())
+    {
+        PROCESS_POOL_INFO("Child " << GetChildIndex() << " perf events are not available, using getrusage()");
+    }
+
     // Running as a child
+    if(mTrace.IsCreated())
+    {
+        std::string name = "child " + std::to_string(GetChildIndex());
+        mTrace.Attach(GetChildIndex(), name.c_str());
+        mTrace.Record(GetChildIndex(), ProcessTrace::EVENT::FORK, GetChildIndex());
+    }
+
+    if(mEnableNuma)
+        AttachNumaNode();
+
     const int SLEEP_USEC = 10000; // 10 ms
+    ProcessStatsSection& stats = mChildInfo[GetChildIndex()].stats;
+    uint64_t markNs = GetMonotonicTimeNs();
+    uint64_t perfPublishNs = markNs;
+    const uint64_t PERF_PUBLISH_INTERVAL_NS = 100000000; // 100 ms
+
     while(!mRequestQueue->stop)
     {
-        // Process next request it we have any
-        Node* node = GetNextRequest();
-        if(node)
+        // Pick up the latest version of the shared data at request boundary
+        for(ProcessRcuBase* rcu : mRcuList)
+            rcu->Quiesce(GetChildIndex());
+
+        // Process broadcast messages we haven't seen yet
+        ProcessBroadcasts();
+
+        // Process next requests it we have any
+        size_t subQueueIndex = 0;
+        Node* batch = GetNextRequest(subQueueIndex);
+        uint64_t isStolen = (subQueueIndex != mSubQueueIndex ? 1 : 0);
+        double hedgePercentile = 0;
+        __atomic_load(&mRequestQueue->hedgePercentile, &hedgePercentile, __ATOMIC_RELAXED);
+        for(Node* node = batch; node; node = node->next)
+        {
+            bool isTraced = IsTraced(node->id);
+            uint64_t startNs = GetMonotonicTimeNs();
+            if(isTraced)
+            {
+                mTrace.Record(GetChildIndex(), ProcessTrace::EVENT::DEQUEUE, node->id, startNs);
+                mTrace.Record(GetChildIndex(), ProcessTrace::EVENT::HANDLER_BEGIN, node->id, startNs);
+            }
+
+            if(hedgePercentile > 0)
+                BeginRun(*node, startNs);
+
+            PROCESS_POOL_PROBE2(request_start, GetChildIndex(), node->id);
+            (*mRequestFptr)(*node); // Process request
+            uint64_t endNs = GetMonotonicTimeNs();
+            PROCESS_POOL_PROBE3(request_done, GetChildIndex(), node->id, endNs - startNs);
+            ReleaseTenant(node->tenant);
+
+            // Note: If a hedged copy finished first, it has counted the request
+            uint64_t isWinner = (hedgePercentile > 0 ? EndRun() : true);
+
+            if(mGetType)
+                LearnCost(*node, endNs - startNs);
+
+            if(isTraced)
+                mTrace.Record(GetChildIndex(), ProcessTrace::EVENT::HANDLER_END, node->id, endNs);
+
+            ProcessQueueLatency& latency = mChildInfo[GetChildIndex()].latency;
+            latency.queueWait.Record(startNs - node->postNs);
+            latency.service.Record(endNs - startNs);
+            if(isWinner)
+                latency.endToEnd.Record(endNs - node->postNs);
+
+            stats.BeginUpdate();
+            ProcessStatsSection::Add(stats.stats.requests, isWinner);
+            ProcessStatsSection::Add(stats.stats.stolen, isStolen);
+            ProcessStatsSection::Add(stats.stats.busyNs, endNs - startNs);
+            ProcessStatsSection::Add(stats.stats.idleNs, startNs - markNs);
+            stats.EndUpdate();
+            markNs = endNs;
+        }
+
+        if(batch)
+        {
+            FreeRequest(batch, subQueueIndex);
+        }
+        else if(hedgePercentile > 0 && HedgeRequest(markNs))
         {
-            (*fptr)(*node); // Process request
-            FreeRequest(node);
+            // Check for requests right away
         }
         else
         {
             usleep(SLEEP_USEC); // sleep SLEEP_USEC milliseconds and check again
+
+            uint64_t nowNs = GetMonotonicTimeNs();
+            stats.BeginUpdate();
+            ProcessStatsSection::Add(stats.stats.idleNs, nowNs - markNs);
+            stats.EndUpdate();
+            markNs = nowNs;
+        }
+
+        // Update perf counters before telling the parent that we are done with the batch,
+        // and every PERF_PUBLISH_INTERVAL_NS (reading counters takes a system call each)
+        bool isDone = !mRequestQueue->hasMore;
+        if(mEnablePerf && ((isDone && !mIsChildDone[GetChildIndex()]) || markNs - perfPublishNs >= PERF_PUBLISH_INTERVAL_NS))
+        {
+            PublishPerfCounters(stats);
+            perfPublishNs = markNs;
         }
 
         // Update this child process "Done" status:
         // 0 - still busy
         // 1 - done with this run
-        mIsChildDone[GetChildIndex()] = (mRequestQueue->hasMore ? 0 : 1);
+        __atomic_store_n(&mIsChildDone[GetChildIndex()], (isDone ? 1 : 0), __ATOMIC_RELEASE);
     }
 
     // Exit child process
+    mTrace.Record(GetChildIndex(), ProcessTrace::EVENT::EXIT, GetChildIndex());
     Exit(true);
 
     return true;
@@ -164,16 +623,135 @@ bool ProcessQueue<ARGS>::Post(const ARGS& args)
 {
     assert(IsParent());
 
+    if(!mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        mPostStatus = POST_STATUS::FAILED;
+        return false;
+    }
+
+    size_t subQueueIndex = (mPostIndex++) % mSubQueues.size();
+    return PostRequest(args, subQueueIndex, 0);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::Post(const ARGS& args, uint64_t estimatedCost)
+{
+    assert(IsParent());
+
+    if(!mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        mPostStatus = POST_STATUS::FAILED;
+        return false;
+    }
+
+    size_t subQueueIndex = (mPostIndex++) % mSubQueues.size();
+    return PostRequest(args, subQueueIndex, 0, estimatedCost);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::PostToTenant(const ARGS& args, unsigned int tenant, uint64_t estimatedCost /*= 0*/)
+{
+    assert(IsParent());
+
+    if(!mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        mPostStatus = POST_STATUS::FAILED;
+        return false;
+    }
+
+    if(tenant >= mTenantCount)
+    {
+        PROCESS_POOL_ERROR("Invalid tenant " << tenant << ", there are " << mTenantCount << " tenants");
+        mRequestQueue->postFailures++;
+        mPostStatus = POST_STATUS::FAILED;
+        return false;
+    }
+
+    size_t subQueueIndex = (mPostIndex++) % mSubQueues.size();
+    return PostRequest(args, subQueueIndex, tenant, estimatedCost);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::PostToNode(const ARGS& args, int numaNode, uint64_t estimatedCost /*= 0*/)
+{
+    assert(IsParent());
+
+    if(!mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        mPostStatus = POST_STATUS::FAILED;
+        return false;
+    }
+
+    // Note: The only sub-queue takes requests of any node if NUMA mode is disabled
+    size_t subQueueIndex = 0;
+    size_t subQueueCount = mSubQueues.size();
+    while(mEnableNuma && subQueueIndex < subQueueCount && mSubQueues[subQueueIndex]->numaNode != numaNode)
+        subQueueIndex++;
+
+    if(subQueueIndex == subQueueCount)
+    {
+        PROCESS_POOL_ERROR("There is no Request Queue of NUMA node " << numaNode);
+        mRequestQueue->postFailures++;
+        mPostStatus = POST_STATUS::FAILED;
+        return false;
+    }
+
+    return PostRequest(args, subQueueIndex, 0, estimatedCost, numaNode);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::PostRequest(const ARGS& args, size_t subQueueIndex, unsigned int tenant, uint64_t cost /*= 0*/,
+                                     int numaNode /*= -1*/)
+{
     // Check for any crash children
     if(HasCrashedChildren())
     {
         // TODO: What should we do if we have a crashed child?
     }
 
-    QueueLock lock(mRequestQueue->lock);
+    // Send statistics notification if it's time to
+    CheckStatsTimer();
+
+    // Pass children log messages and output, etc.
+    PollChildren();
+
+    // Note: Stamp the request before waiting for the lock
+    uint64_t postNs = GetMonotonicTimeNs();
+
+    // Capture the offered request even if the queue can't take it
+    if(mCapture.IsOpen())
+        mCapture.Write(postNs, &args, sizeof(ARGS), tenant, cost, numaNode);
+
+    // Note: Children detect overload when they take requests
+    bool isOverloaded = __atomic_load_n(&mRequestQueue->isOverloaded, __ATOMIC_RELAXED);
+    if(isOverloaded != mIsShedding)
+    {
+        mIsShedding = isOverloaded;
+        PROCESS_POOL_INFO("Request Queue " << (isOverloaded ? "is overloaded, shedding requests" : "is no longer overloaded")
+                          << ", " << mRequestQueue->shed << " requests shed so far");
+    }
+
+    if(isOverloaded && (!mIsSheddable || (*mIsSheddable)(args)))
+    {
+        mRequestQueue->shed++;
+        mPostStatus = POST_STATUS::SHED;
+        return false;
+    }
+
+    // Note: Learned costs are looked up outside of the lock
+    unsigned int group = (mCostGroups > 1 ? GetCostGroup(args, cost) : 0);
+
+    mPostStatus = POST_STATUS::FAILED;
+    SubQueue& subQueue = *mSubQueues[subQueueIndex];
+    QueueLock lock(subQueue.lock, &mParentStats);
     if(!lock)
     {
         PROCESS_POOL_ERROR("Failed to obtain Request Queue lock");
+        mRequestQueue->postFailures++;
         return false;
     }
 
@@ -181,188 +759,947 @@ bool ProcessQueue<ARGS>::Post(const ARGS& args)
 
     // Check if we have any free nodes that we can use.
     // Otherwise, allocate new node.
-    if(mRequestQueue->free)
+    if(subQueue.free)
     {
-        node = mRequestQueue->free;
-        mRequestQueue->free = node->next;
+        node = subQueue.free;
+        subQueue.free = node->next;
     }
     else
     {
-        size_t availableSize = mRequestQueueSize - (mRequestQueue->fillPtr - (unsigned char*)mRequestQueue);
+        size_t availableSize = subQueue.endPtr - subQueue.fillPtr;
         if(availableSize < sizeof(Node))
         {
             PROCESS_POOL_ERROR("Request Queue is out of memory");
+            mRequestQueue->postFailures++;
             return false;
         }
 
-        node = new (mRequestQueue->fillPtr) Node;
-        mRequestQueue->fillPtr = mRequestQueue->fillPtr + sizeof(Node);
+        node = new (subQueue.fillPtr) Node;
+        subQueue.fillPtr = subQueue.fillPtr + sizeof(Node);
     }
 
     // Copy input request
     (ARGS&)(*node) = args;
+    node->postNs = postNs;
+    node->id = mRequestQueue->posted;
+    node->tenant = tenant;
 
-    // Append new node to the tail
-    Node* tail = mRequestQueue->tail;
+    if(IsTraced(node->id))
+        mTrace.Record(mTraceParentIndex, ProcessTrace::EVENT::POST, node->id, postNs);
+
+    // Append new node to the tail of its cost group
+    TenantQueue& queue = subQueue.tenants[tenant];
+    RequestList& list = queue.lists[group];
+    Node* tail = list.tail;
     if(!tail)
     {
         // Very first node
-        assert(!mRequestQueue->head);
-        mRequestQueue->head = node;
+        assert(!list.head);
+        list.head = node;
+        queue.nonEmpty |= (1ULL << group);
     }
     else
     {
         tail->next = node;
     }
-    mRequestQueue->tail = node;
+    list.tail = node;
     node->next = nullptr;
+    __atomic_store_n(&subQueue.depth, subQueue.depth + 1, __ATOMIC_RELAXED);
+
+    mRequestQueue->posted++;
+    __atomic_store_n(&mTenantInfo[tenant].posted, mTenantInfo[tenant].posted + 1, __ATOMIC_RELAXED);
+    uint64_t depth = __atomic_add_fetch(&mRequestQueue->depth, 1, __ATOMIC_RELAXED);
+    if(depth > mRequestQueue->maxDepth)
+        mRequestQueue->maxDepth = depth;
 
+    PROCESS_POOL_PROBE2(post, node->id, depth);
+
+    mPostStatus = POST_STATUS::OK;
     return true;
 }
 
 template<class ARGS>
-typename ProcessQueue<ARGS>::Node* ProcessQueue<ARGS>::GetNextRequest()
+bool ProcessQueue<ARGS>::Broadcast(const ARGS& msg, int waitMilliseconds /*= 5000*/)
 {
-    assert(IsChild());
+    assert(IsParent());
 
-    QueueLock lock(mRequestQueue->lock);
-    if(!lock)
+    if(!mRequestQueue)
     {
-        PROCESS_POOL_ERROR("Failed to obtain Request Queue lock");
-        return nullptr;
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        return false;
     }
 
-    // Detach and return head request
-    Node* node = mRequestQueue->head;
-    if(node)
+    // Wait for the slowest child to free a slot in the ring
+    const int SLEEP_MICROSEC = 1000; // 1 ms
+    int waitUseconds = waitMilliseconds * 1000;
+    uint64_t seq = mRequestQueue->broadcastSeq;
+
+    while(seq - GetBroadcastAck() >= BROADCAST_RING_SIZE)
     {
-        mRequestQueue->head = node->next;
+        if(waitUseconds <= 0)
+        {
+            PROCESS_POOL_ERROR("Broadcast ring is full");
+            return false;
+        }
 
-        // If this very last node, then update tail as well
-        if(!mRequestQueue->head)
-            mRequestQueue->tail = nullptr;
+        // Check for any crash children
+        HasCrashedChildren();
+
+        usleep(SLEEP_MICROSEC);
+        waitUseconds -= SLEEP_MICROSEC;
     }
 
-    return node;
+    // Note: The slot isn't read by any child until the sequence is updated
+    mRequestQueue->broadcastRing[seq % BROADCAST_RING_SIZE] = msg;
+    __atomic_store_n(&mRequestQueue->broadcastSeq, seq + 1, __ATOMIC_RELEASE);
+    return true;
 }
 
 template<class ARGS>
-void ProcessQueue<ARGS>::FreeRequest(ProcessQueue::Node* node)
+bool ProcessQueue<ARGS>::WaitForBroadcast(int waitMilliseconds /*= 5000*/)
 {
-    assert(IsChild());
+    assert(IsParent());
 
-    if(!node)
-        return;
+    if(!mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        return false;
+    }
 
-    QueueLock lock(mRequestQueue->lock);
-    if(!lock)
+    // Loop until every running child has processed all messages
+    uint64_t deadlineNs = GetMonotonicTimeNs() + (uint64_t)waitMilliseconds * 1000000;
+    for(useconds_t delay = 1000 /*1 ms*/; GetBroadcastAck() < mRequestQueue->broadcastSeq; usleep(delay))
     {
-        PROCESS_POOL_ERROR("Failed to obtain Request Queue lock");
-        return;
+        if(GetMonotonicTimeNs() >= deadlineNs)
+        {
+            PROCESS_POOL_ERROR("Children haven't processed broadcast messages in " << waitMilliseconds << " ms");
+            return false;
+        }
+
+        // Check for any crash children
+        if(HasCrashedChildren())
+        {
+            // Note: Crashed child is no longer counted by GetBroadcastAck()
+        }
+
+        // Send statistics notification if it's time to
+        CheckStatsTimer();
+
+        // Pass children log messages and output, etc.
+        PollChildren();
     }
 
-    // Add request node to the free chain to be reused
-    node->next = mRequestQueue->free;
-    mRequestQueue->free = node;
+    return true;
 }
 
+// Get the number of broadcast messages processed by all running children
 template<class ARGS>
-bool ProcessQueue<ARGS>::CreateRequestQueue()
+uint64_t ProcessQueue<ARGS>::GetBroadcastAck()
 {
-    assert(IsParent());
+    uint64_t minAck = mRequestQueue->broadcastSeq;
+    size_t childrenCount = mChildrenPIDs.size();
 
-    // Clean up first
-    DeleteRequestQueue();
-    assert(!mRequestQueue);
+    for(size_t childIndex = 0; childIndex < childrenCount; childIndex++)
+    {
+        if(mChildrenPIDs[childIndex].status != CHILD_STATUS::RUNNING)
+            continue; // Skip the child that is not running or done
+
+        uint64_t ack = __atomic_load_n(&mChildInfo[childIndex].broadcastAck, __ATOMIC_ACQUIRE);
+        if(ack < minAck)
+            minAck = ack;
+    }
+
+    return minAck;
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::ProcessBroadcasts()
+{
+    assert(IsChild());
 
-    if(mRequestQueueSize == 0)
+    ChildInfo& info = mChildInfo[GetChildIndex()];
+    uint64_t seq = __atomic_load_n(&mRequestQueue->broadcastSeq, __ATOMIC_ACQUIRE);
+
+    // Note: The parent doesn't reuse the slot until we acknowledge it
+    for(uint64_t ack = info.broadcastAck; ack < seq; ack++)
     {
-        PROCESS_POOL_ERROR("Invalid (0) Request Queue size");
-        return false;
+        (*mBroadcastFptr)(mRequestQueue->broadcastRing[ack % BROADCAST_RING_SIZE]);
+        __atomic_store_n(&info.broadcastAck, ack + 1, __ATOMIC_RELEASE);
+
+        info.stats.BeginUpdate();
+        ProcessStatsSection::Add(info.stats.stats.broadcasts, 1);
+        info.stats.EndUpdate();
     }
+}
 
-    // Open the shared memory.
-    unsigned char* addr = (unsigned char*)::mmap(NULL, mRequestQueueSize, PROT_READ | PROT_WRITE,
-            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+template<class ARGS>
+bool ProcessQueue<ARGS>::AddRcu(ProcessRcuBase& rcu)
+{
+    assert(IsParent());
 
-    if(addr == MAP_FAILED)
+    if(mRequestQueue)
     {
-        std::string errmsg = strerror(errno);
-        PROCESS_POOL_ERROR("mmap for " << mRequestQueueSize << " bytes failed with error \"" << errmsg << "\"");
+        PROCESS_POOL_ERROR("Shared data must be added before Create()");
         return false;
     }
 
-    // Create Request Queue in shared memory
-    mRequestQueue = new (addr) RequestQueue;
-    assert((void*)mRequestQueue == (void*)addr);
-
-    // Set next available address for a new allocation
-    mRequestQueue->fillPtr = addr + sizeof(RequestQueue);
+    mRcuList.push_back(&rcu);
     return true;
 }
 
 template<class ARGS>
-void ProcessQueue<ARGS>::DeleteRequestQueue()
+typename ProcessQueue<ARGS>::Node* ProcessQueue<ARGS>::GetNextRequest(size_t& subQueueIndex)
 {
-    assert(IsParent());
+    assert(IsChild());
 
-    if(mRequestQueue)
+    // Start with the child's own sub-queue
+    size_t subQueueCount = mSubQueues.size();
+    bool isEmpty = true;
+    for(size_t i = 0; i < subQueueCount; i++)
     {
-        if(::munmap(mRequestQueue, mRequestQueueSize) < 0)
+        subQueueIndex = (mSubQueueIndex + i) % subQueueCount;
+        SubQueue& subQueue = *mSubQueues[subQueueIndex];
+
+        // Note: Don't take the lock (likely of another node's memory) to find nothing
+        if(!__atomic_load_n(&subQueue.depth, __ATOMIC_RELAXED))
+            continue;
+        isEmpty = false;
+
+        QueueLock lock(subQueue.lock, GetStatsSection());
+        if(!lock)
         {
-            std::string errmsg = strerror(errno);
-            PROCESS_POOL_ERROR("munmap failed with error \"" << errmsg << "\"");
+            PROCESS_POOL_ERROR("Failed to obtain Request Queue lock");
+            continue;
         }
+
+        Node* node = DetachRequests(subQueue);
+        if(node)
+            return node;
     }
 
-    mRequestQueue = nullptr;
+    // Nothing waits in the queue (rather than for tenants' running slots)
+    if(isEmpty)
+        UpdateOverload(0, 0);
+
+    subQueueIndex = mSubQueueIndex;
+    return nullptr;
 }
 
+// Detach and return up to dequeueBatch head requests of the tenant whose
+// turn it is (deficit round robin, under the sub-queue lock)
 template<class ARGS>
-bool ProcessQueue<ARGS>::WaitForCompletion()
+typename ProcessQueue<ARGS>::Node* ProcessQueue<ARGS>::DetachRequests(SubQueue& subQueue)
 {
-    assert(IsParent());
+    unsigned int dequeueBatch = __atomic_load_n(&mRequestQueue->dequeueBatch, __ATOMIC_RELAXED);
 
-    // Loop until no request left in Request Queue
-    bool keepWaiting = true;
-    for(useconds_t delay = 10000 /*10 ms*/; keepWaiting; usleep(delay))
+    // Note: The current tenant might be visited twice if it has a deficit left
+    for(unsigned int visited = 0; visited <= mTenantCount && subQueue.depth; visited++)
     {
-        // Check for any crash children
-        if(HasCrashedChildren())
+        unsigned int tenant = subQueue.tenant;
+        TenantQueue& queue = subQueue.tenants[tenant];
+
+        // A tenant starts its turn with weight * dequeueBatch requests to take
+        unsigned int count = 0;
+        if(queue.nonEmpty)
         {
-            // TODO: What should we do if we have a crashed child?
+            if(queue.deficit == 0)
+                queue.deficit = (uint64_t)__atomic_load_n(&mTenantInfo[tenant].weight, __ATOMIC_RELAXED) * dequeueBatch;
+            count = AcquireTenant(tenant, (unsigned int)std::min<uint64_t>(dequeueBatch, queue.deficit));
         }
 
+        // Tenants without requests or at their concurrency limit pass their turn
+        if(count == 0)
         {
-            QueueLock lock(mRequestQueue->lock);
-            if(!lock)
-            {
-                PROCESS_POOL_ERROR("Failed to obtain Request Queue lock");
-                return false;
-            }
+            queue.deficit = 0;
+            subQueue.tenant = (tenant + 1) % mTenantCount;
+            continue;
+        }
+
+        // The most expensive cost group first
+        unsigned int group = 63 - __builtin_clzll(queue.nonEmpty);
+        RequestList& list = queue.lists[group];
+        Node* node = list.head;
 
-            // Once request queue is empty, reset hasMore flag
-            if(!mRequestQueue->head)
-                mRequestQueue->hasMore = false;
+        // Note: The queue wait of the oldest request of the group
+        if(__atomic_load_n(&mRequestQueue->shedTargetNs, __ATOMIC_RELAXED))
+        {
+            uint64_t nowNs = GetMonotonicTimeNs();
+            UpdateOverload(nowNs - node->postNs, nowNs);
         }
 
-        // Note: we no longer need QueueLock
-        if(!mRequestQueue->hasMore)
+        Node* last = node;
+        unsigned int detached = 1;
+        PROCESS_POOL_PROBE3(dequeue, GetChildIndex(), last->id, last->postNs);
+
+        for(; detached < count && last->next; detached++)
         {
-            // Wait for child processes to complete
-            keepWaiting = false;    // Assuming all processes are done
-            size_t childrenCount = mChildrenPIDs.size();
-            for(size_t childIndex = 0; childIndex < childrenCount; childIndex++)
-            {
-                if(mIsChildDone[childIndex] == 0)
-                {
-                    // Got child process that is still busy...keep waiting
-                    keepWaiting = true;
-                    break;
-                }
-            }
+            last = last->next;
+            PROCESS_POOL_PROBE3(dequeue, GetChildIndex(), last->id, last->postNs);
         }
-    }
+
+        // Return the slots we didn't use
+        if(detached < count)
+            __atomic_sub_fetch(&mTenantInfo[tenant].running, count - detached, __ATOMIC_RELAXED);
+
+        list.head = last->next;
+        queue.deficit -= detached;
+        __atomic_store_n(&subQueue.depth, subQueue.depth - detached, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&mRequestQueue->depth, detached, __ATOMIC_RELAXED);
+        last->next = nullptr;
+
+        // If this very last node, then update tail as well
+        if(!list.head)
+        {
+            list.tail = nullptr;
+            queue.nonEmpty &= ~(1ULL << group);
+            if(!queue.nonEmpty)
+                queue.deficit = 0;
+        }
+
+        // The next tenant's turn
+        if(queue.deficit == 0)
+            subQueue.tenant = (tenant + 1) % mTenantCount;
+
+        return node;
+    }
+
+    return nullptr;
+}
+
+// Take up to count running slots of the tenant, returns the number taken
+template<class ARGS>
+unsigned int ProcessQueue<ARGS>::AcquireTenant(unsigned int tenant, unsigned int count)
+{
+    TenantInfo& info = mTenantInfo[tenant];
+    uint64_t maxRunning = __atomic_load_n(&info.maxRunning, __ATOMIC_RELAXED);
+    if(maxRunning == 0)
+    {
+        __atomic_add_fetch(&info.running, count, __ATOMIC_RELAXED);
+        return count;
+    }
+
+    // Note: Children of other sub-queues take slots of the same tenant concurrently
+    uint64_t running = __atomic_load_n(&info.running, __ATOMIC_RELAXED);
+    while(true)
+    {
+        uint64_t available = (running < maxRunning ? maxRunning - running : 0);
+        uint64_t taken = std::min<uint64_t>(count, available);
+        if(taken == 0)
+            return 0;
+
+        if(__atomic_compare_exchange_n(&info.running, &running, running + taken, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return (unsigned int)taken;
+    }
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::ReleaseTenant(unsigned int tenant, bool isCompleted /*= true*/)
+{
+    __atomic_sub_fetch(&mTenantInfo[tenant].running, 1, __ATOMIC_RELAXED);
+    if(isCompleted)
+        __atomic_add_fetch(&mTenantInfo[tenant].completed, 1, __ATOMIC_RELAXED);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::EnableCostScheduling(unsigned int (*getType)(const ARGS&) /*= nullptr*/,
+                                              unsigned int typeCount /*= 0*/)
+{
+    assert(IsParent());
+
+    if(mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Cost scheduling must be enabled before Create()");
+        return false;
+    }
+
+    mCostGroups = COST_GROUPS;
+    mGetType = (typeCount > 0 ? getType : nullptr);
+    mTypeCount = (mGetType ? typeCount : 0);
+    return true;
+}
+
+// Group of requests that cost about the same: the power of two of the cost
+template<class ARGS>
+unsigned int ProcessQueue<ARGS>::GetCostGroup(const ARGS& args, uint64_t cost) const
+{
+    if(mGetType)
+    {
+        unsigned int type = (*mGetType)(args);
+        if(type < mTypeCount && __atomic_load_n(&mTypeCosts[type].samples, __ATOMIC_RELAXED))
+            cost = __atomic_load_n(&mTypeCosts[type].costNs, __ATOMIC_RELAXED);
+    }
+
+    return (cost ? std::min(64 - __builtin_clzll(cost), (int)COST_GROUPS - 1) : 0);
+}
+
+// Update the learned cost of the request type with its service time
+template<class ARGS>
+void ProcessQueue<ARGS>::LearnCost(const ARGS& args, uint64_t serviceNs)
+{
+    unsigned int type = (*mGetType)(args);
+    if(type >= mTypeCount)
+        return;
+
+    // Note: Children of the same type race to update it, a lost sample doesn't matter
+    TypeCost& typeCost = mTypeCosts[type];
+    uint64_t costNs = __atomic_load_n(&typeCost.costNs, __ATOMIC_RELAXED);
+    uint64_t samples = __atomic_load_n(&typeCost.samples, __ATOMIC_RELAXED);
+    costNs = (samples ? costNs - costNs / 8 + serviceNs / 8 : serviceNs);
+    __atomic_store_n(&typeCost.costNs, costNs, __ATOMIC_RELAXED);
+    __atomic_store_n(&typeCost.samples, samples + 1, __ATOMIC_RELAXED);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::SetTenantCount(unsigned int tenantCount)
+{
+    assert(IsParent());
+
+    if(mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Tenants must be set before Create()");
+        return false;
+    }
+
+    if(tenantCount == 0)
+    {
+        PROCESS_POOL_ERROR("Invalid (0) number of tenants");
+        return false;
+    }
+
+    mTenantCount = tenantCount;
+    mTenantSettings.resize(tenantCount);
+    return true;
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::SetTenant(unsigned int tenant, unsigned int weight, unsigned int maxRunning /*= 0*/)
+{
+    assert(IsParent());
+
+    if(tenant >= mTenantCount || weight == 0)
+    {
+        PROCESS_POOL_ERROR("Invalid tenant " << tenant << " or its weight " << weight);
+        return false;
+    }
+
+    mTenantSettings.resize(mTenantCount);
+    mTenantSettings[tenant].weight = weight;
+    mTenantSettings[tenant].maxRunning = maxRunning;
+    if(mTenantInfo)
+    {
+        __atomic_store_n(&mTenantInfo[tenant].weight, weight, __ATOMIC_RELAXED);
+        __atomic_store_n(&mTenantInfo[tenant].maxRunning, maxRunning, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::FreeRequest(ProcessQueue::Node* node, size_t subQueueIndex)
+{
+    assert(IsChild());
+
+    if(!node)
+        return;
+
+    Node* last = node;
+    PROCESS_POOL_PROBE2(free_request, GetChildIndex(), last->id);
+    for(; last->next; last = last->next)
+        PROCESS_POOL_PROBE2(free_request, GetChildIndex(), last->next->id);
+
+    // Note: Nodes go back to the sub-queue (and NUMA node) they came from
+    SubQueue& subQueue = *mSubQueues[subQueueIndex];
+    QueueLock lock(subQueue.lock, GetStatsSection());
+    if(!lock)
+    {
+        PROCESS_POOL_ERROR("Failed to obtain Request Queue lock");
+        return;
+    }
+
+    // Add request nodes to the free chain to be reused
+    last->next = subQueue.free;
+    subQueue.free = node;
+}
+
+// Track the queue wait of requests children take (CoDel-style): the queue is
+// overloaded once the queue wait stays above the target for the whole interval
+template<class ARGS>
+void ProcessQueue<ARGS>::UpdateOverload(uint64_t queueWaitNs, uint64_t nowNs)
+{
+    // Note: Children of different sub-queues update the state concurrently,
+    // a lost update only delays detection
+    uint64_t targetNs = __atomic_load_n(&mRequestQueue->shedTargetNs, __ATOMIC_RELAXED);
+    uint64_t overloadNs = __atomic_load_n(&mRequestQueue->overloadNs, __ATOMIC_RELAXED);
+    if(queueWaitNs < targetNs || targetNs == 0)
+    {
+        // Don't write into the shared cache line unless the state changes
+        if(overloadNs)
+            __atomic_store_n(&mRequestQueue->overloadNs, 0, __ATOMIC_RELAXED);
+        if(__atomic_load_n(&mRequestQueue->isOverloaded, __ATOMIC_RELAXED))
+            __atomic_store_n(&mRequestQueue->isOverloaded, false, __ATOMIC_RELAXED);
+    }
+    else if(!overloadNs)
+    {
+        uint64_t intervalNs = __atomic_load_n(&mRequestQueue->shedIntervalNs, __ATOMIC_RELAXED);
+        __atomic_store_n(&mRequestQueue->overloadNs, nowNs + intervalNs, __ATOMIC_RELAXED);
+    }
+    else if(nowNs >= overloadNs && !__atomic_load_n(&mRequestQueue->isOverloaded, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&mRequestQueue->isOverloaded, true, __ATOMIC_RELAXED);
+    }
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::SetShedding(int targetMilliseconds, int intervalMilliseconds /*= 100*/,
+                                     bool (*isSheddable)(const ARGS&) /*= nullptr*/)
+{
+    assert(IsParent());
+
+    mShedTargetNs = (targetMilliseconds > 0 ? targetMilliseconds * 1000000ULL : 0);
+    mShedIntervalNs = (intervalMilliseconds > 0 ? intervalMilliseconds * 1000000ULL : 0);
+    mIsSheddable = isSheddable;
+    if(mRequestQueue)
+    {
+        __atomic_store_n(&mRequestQueue->shedIntervalNs, mShedIntervalNs, __ATOMIC_RELAXED);
+        __atomic_store_n(&mRequestQueue->shedTargetNs, mShedTargetNs, __ATOMIC_RELAXED);
+        if(!mShedTargetNs)
+            __atomic_store_n(&mRequestQueue->isOverloaded, false, __ATOMIC_RELAXED);
+    }
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::SetHedging(double percentile)
+{
+    static_assert(std::is_trivially_copyable<ARGS>::value, "Hedged requests must be trivially copyable");
+    assert(IsParent());
+
+    mHedgePercentile = (percentile > 0 ? std::min(percentile, 100.0) : 0);
+    if(mRequestQueue)
+        __atomic_store(&mRequestQueue->hedgePercentile, &mHedgePercentile, __ATOMIC_RELAXED);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::IsCancelled() const
+{
+    if(!IsChild() || !mRequestQueue)
+        return false;
+
+    // The hedging child lost if the original has finished (or moved on)
+    if(mHedgeChild >= 0)
+        return (__atomic_load_n(&mChildInfo[mHedgeChild].runState, __ATOMIC_RELAXED) != mHedgeState);
+
+    uint64_t state = __atomic_load_n(&mChildInfo[GetChildIndex()].runState, __ATOMIC_RELAXED);
+    return ((state & RUN_STATE_MASK) == RUN_HEDGE_WON);
+}
+
+// Publish the request the child starts processing to be hedged
+template<class ARGS>
+void ProcessQueue<ARGS>::BeginRun(const Node& node, uint64_t startNs)
+{
+    // Note: The state is idle here (see EndRun()), hedging children skip the request
+    // until it's published below
+    ChildInfo& info = mChildInfo[GetChildIndex()];
+    CopyRunArgs(info.runArgs, (const ARGS&)node);
+    __atomic_store_n(&info.runStartNs, startNs, __ATOMIC_RELAXED);
+    __atomic_store_n(&info.runPostNs, node.postNs, __ATOMIC_RELAXED);
+    __atomic_store_n(&info.runId, node.id, __ATOMIC_RELAXED);
+    __atomic_store_n(&info.runTenant, node.tenant, __ATOMIC_RELAXED);
+
+    // Note: A hedging child takes the request only if the state hasn't changed since it read it
+    mRunSeq++;
+    __atomic_store_n(&info.runState, (mRunSeq << 2) | RUN_ORIGINAL, __ATOMIC_RELEASE);
+}
+
+// Returns false if the hedged copy has finished first
+template<class ARGS>
+bool ProcessQueue<ARGS>::EndRun()
+{
+    ChildInfo& info = mChildInfo[GetChildIndex()];
+    uint64_t state = __atomic_exchange_n(&info.runState, (mRunSeq << 2) | RUN_IDLE, __ATOMIC_ACQ_REL);
+    return ((state & RUN_STATE_MASK) != RUN_HEDGE_WON);
+}
+
+// Run a copy of another child's request that takes longer than the hedge threshold
+template<class ARGS>
+bool ProcessQueue<ARGS>::HedgeRequest(uint64_t& markNs)
+{
+    assert(IsChild());
+
+    uint64_t thresholdNs = GetHedgeThreshold();
+    if(!thresholdNs)
+        return false; // Not enough service times observed yet
+
+    uint64_t nowNs = GetMonotonicTimeNs();
+    for(size_t childIndex = 0; childIndex < mChildInfoCount; childIndex++)
+    {
+        ChildInfo& info = mChildInfo[childIndex];
+        uint64_t state = __atomic_load_n(&info.runState, __ATOMIC_ACQUIRE);
+        if((int)childIndex == GetChildIndex() || (state & RUN_STATE_MASK) != RUN_ORIGINAL ||
+           nowNs < __atomic_load_n(&info.runStartNs, __ATOMIC_RELAXED) + thresholdNs)
+            continue;
+
+        // Take the request the way a seqlock reader does: the copy is consistent
+        // only if the child is still processing the same request after it
+        ARGS args;
+        CopyRunArgs(args, info.runArgs);
+        uint64_t postNs = __atomic_load_n(&info.runPostNs, __ATOMIC_RELAXED);
+        uint64_t id = __atomic_load_n(&info.runId, __ATOMIC_RELAXED);
+        unsigned int tenant = __atomic_load_n(&info.runTenant, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&info.runState, __ATOMIC_RELAXED) != state)
+            continue; // The child has moved on while we copied its request
+
+        // The copy runs against the tenant's cap like any other request
+        if(!AcquireTenant(tenant, 1))
+            continue;
+
+        // Note: The child is busy until the copy returns, even if the original finishes first.
+        // The flag is cleared before the copy is published, so the original can't report
+        // done before it (see WaitForCompletion()).
+        unsigned char isDone = mIsChildDone[GetChildIndex()];
+        __atomic_store_n(&mIsChildDone[GetChildIndex()], 0, __ATOMIC_SEQ_CST);
+
+        uint64_t hedgeState = (state & ~RUN_STATE_MASK) | RUN_HEDGED;
+        if(!__atomic_compare_exchange_n(&info.runState, &state, hedgeState, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&mIsChildDone[GetChildIndex()], isDone, __ATOMIC_RELEASE);
+            ReleaseTenant(tenant, false);
+            continue;
+        }
+
+        mHedgeChild = (int)childIndex;
+        mHedgeState = hedgeState;
+        PROCESS_POOL_INFO("Child " << GetChildIndex() << " hedges request of child " << childIndex
+                          << " running for " << (nowNs - info.runStartNs) / 1000 << " us");
+
+        bool isTraced = IsTraced(id);
+        uint64_t startNs = GetMonotonicTimeNs();
+        if(isTraced)
+            mTrace.Record(GetChildIndex(), ProcessTrace::EVENT::HANDLER_BEGIN, id, startNs);
+
+        PROCESS_POOL_PROBE2(request_start, GetChildIndex(), id);
+        (*mRequestFptr)(args); // Process the copy
+        uint64_t endNs = GetMonotonicTimeNs();
+        PROCESS_POOL_PROBE3(request_done, GetChildIndex(), id, endNs - startNs);
+
+        // Note: The original counts the request as completed
+        ReleaseTenant(tenant, false);
+
+        uint64_t wonState = (state & ~RUN_STATE_MASK) | RUN_HEDGE_WON;
+        uint64_t isWinner = __atomic_compare_exchange_n(&info.runState, &hedgeState, wonState, false,
+                                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        mHedgeChild = -1;
+
+        if(isTraced)
+            mTrace.Record(GetChildIndex(), ProcessTrace::EVENT::HANDLER_END, id, endNs);
+
+        // Note: A cancelled copy is recorded too, its time is spent anyway
+        ProcessQueueLatency& latency = mChildInfo[GetChildIndex()].latency;
+        latency.service.Record(endNs - startNs);
+        if(isWinner)
+            latency.endToEnd.Record(endNs - postNs);
+
+        ProcessStatsSection& stats = mChildInfo[GetChildIndex()].stats;
+        stats.BeginUpdate();
+        ProcessStatsSection::Add(stats.stats.requests, isWinner);
+        ProcessStatsSection::Add(stats.stats.hedged, 1);
+        ProcessStatsSection::Add(stats.stats.hedgeWins, isWinner);
+        ProcessStatsSection::Add(stats.stats.busyNs, endNs - startNs);
+        ProcessStatsSection::Add(stats.stats.idleNs, startNs - markNs);
+        stats.EndUpdate();
+        markNs = endNs;
+        return true;
+    }
+
+    return false;
+}
+
+// Copy request published for hedging. Other children read it while its child writes it,
+// so it's copied byte by byte with atomics (see BeginRun() and HedgeRequest())
+template<class ARGS>
+void ProcessQueue<ARGS>::CopyRunArgs(ARGS& dst, const ARGS& src)
+{
+    unsigned char* to = reinterpret_cast<unsigned char*>(&dst);
+    const unsigned char* from = reinterpret_cast<const unsigned char*>(&src);
+    for(size_t index = 0; index < sizeof(ARGS); index++)
+        __atomic_store_n(&to[index], __atomic_load_n(&from[index], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+// Percentile of service times of all children, 0 if it's not known yet
+template<class ARGS>
+uint64_t ProcessQueue<ARGS>::GetHedgeThreshold()
+{
+    // Note: One of idle children updates the threshold every HEDGE_UPDATE_INTERVAL_NS
+    uint64_t nowNs = GetMonotonicTimeNs();
+    uint64_t updateNs = __atomic_load_n(&mRequestQueue->hedgeUpdateNs, __ATOMIC_RELAXED);
+    if(nowNs - updateNs >= HEDGE_UPDATE_INTERVAL_NS &&
+       __atomic_compare_exchange_n(&mRequestQueue->hedgeUpdateNs, &updateNs, nowNs, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        LatencyHistogram service;
+        for(size_t childIndex = 0; childIndex < mChildInfoCount; childIndex++)
+            service.Add(mChildInfo[childIndex].latency.service);
+
+        double percentile = 0;
+        __atomic_load(&mRequestQueue->hedgePercentile, &percentile, __ATOMIC_RELAXED);
+        uint64_t thresholdNs = (service.count >= MIN_HEDGE_SAMPLES ? service.GetPercentile(percentile) : 0);
+        __atomic_store_n(&mRequestQueue->hedgeThresholdNs, thresholdNs, __ATOMIC_RELAXED);
+    }
+
+    return __atomic_load_n(&mRequestQueue->hedgeThresholdNs, __ATOMIC_RELAXED);
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::AttachNumaNode()
+{
+    assert(IsChild());
+
+    // Spread children over nodes unless they are pinned to CPUs already
+    mSubQueueIndex = GetChildIndex() % mSubQueues.size();
+    int cpu = GetChildCpu(GetChildIndex());
+    if(cpu >= 0)
+    {
+        for(size_t index = 0; index < mNumaNodes.size(); index++)
+        {
+            const std::vector<int>& cpus = mNumaNodes[index].cpus;
+            if(std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+                mSubQueueIndex = index;
+        }
+    }
+    else if(!ProcessAffinity::SetAffinity(mNumaNodes[mSubQueueIndex].cpus))
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Child " << GetChildIndex() << " couldn't be pinned to NUMA node "
+                           << mNumaNodes[mSubQueueIndex].node << " because " << errmsg);
+    }
+
+    PROCESS_POOL_INFO("Child " << GetChildIndex() << " serves NUMA node " << mNumaNodes[mSubQueueIndex].node);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::EnableNuma(bool enable /*= true*/)
+{
+    assert(IsParent());
+
+    if(mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("NUMA mode must be enabled before Create()");
+        return false;
+    }
+
+    mEnableNuma = enable;
+    return true;
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::CreateRequestQueue(int procCount)
+{
+    assert(IsParent());
+
+    // Clean up first
+    DeleteRequestQueue();
+    assert(!mRequestQueue);
+
+    unsigned int maxRequestCount = GetMaxRequestCount();
+    if(maxRequestCount == 0)
+    {
+        PROCESS_POOL_ERROR("Invalid (0) Request Queue size");
+        return false;
+    }
+
+    mNumaNodes.clear();
+    if(mEnableNuma)
+        mNumaNodes = ProcessAffinity::GetNodes();
+    size_t subQueueCount = (mNumaNodes.empty() ? 1 : mNumaNodes.size());
+
+    // Shared memory layout: RequestQueue, ChildInfo[procCount], TenantInfo[mTenantCount] and
+    // TypeCost[mTypeCount], followed by SubQueue, TenantQueue[mTenantCount], RequestList[mTenantCount * mCostGroups]
+    // and Node[maxRequestCount] of every sub-queue, each starting at a page boundary to be bound to its NUMA node
+    const size_t PAGE_SIZE = sysconf(_SC_PAGESIZE);
+    size_t childInfoCount = (procCount > 0 ? procCount : 0);
+    size_t controlSize = sizeof(RequestQueue) + sizeof(ChildInfo) * childInfoCount +
+                         sizeof(TenantInfo) * mTenantCount + sizeof(TypeCost) * mTypeCount;
+    size_t tenantQueuesSize = sizeof(TenantQueue) * mTenantCount + sizeof(RequestList) * mTenantCount * mCostGroups;
+    tenantQueuesSize = (tenantQueuesSize + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    size_t subQueueSize = sizeof(SubQueue) + tenantQueuesSize + sizeof(Node) * maxRequestCount;
+    controlSize = (controlSize + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    subQueueSize = (subQueueSize + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    mRequestQueueSize = controlSize + subQueueSize * subQueueCount;
+
+    // Open the shared memory.
+    unsigned char* addr = (unsigned char*)::mmap(NULL, mRequestQueueSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if(addr == MAP_FAILED)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("mmap for " << mRequestQueueSize << " bytes failed with error \"" << errmsg << "\"");
+        return false;
+    }
+
+    // Create Request Queue and children info in shared memory
+    mRequestQueue = new (addr) RequestQueue;
+    assert((void*)mRequestQueue == (void*)addr);
+    mRequestQueue->dequeueBatch = mDequeueBatch;
+    mRequestQueue->shedTargetNs = mShedTargetNs;
+    mRequestQueue->shedIntervalNs = mShedIntervalNs;
+    mRequestQueue->hedgePercentile = mHedgePercentile;
+    mChildInfoCount = childInfoCount;
+    mChildInfo = (ChildInfo*)(addr + sizeof(RequestQueue));
+    for(size_t childIndex = 0; childIndex < childInfoCount; childIndex++)
+        new (&mChildInfo[childIndex]) ChildInfo;
+
+    mTenantInfo = (TenantInfo*)(addr + sizeof(RequestQueue) + sizeof(ChildInfo) * childInfoCount);
+    mTenantSettings.resize(mTenantCount);
+    for(unsigned int tenant = 0; tenant < mTenantCount; tenant++)
+    {
+        new (&mTenantInfo[tenant]) TenantInfo;
+        mTenantInfo[tenant].weight = mTenantSettings[tenant].weight;
+        mTenantInfo[tenant].maxRunning = mTenantSettings[tenant].maxRunning;
+    }
+
+    mTypeCosts = (TypeCost*)(mTenantInfo + mTenantCount);
+    for(unsigned int type = 0; type < mTypeCount; type++)
+        new (&mTypeCosts[type]) TypeCost;
+
+    for(size_t index = 0; index < subQueueCount; index++)
+    {
+        // Note: Bind the memory before the very first page is touched
+        unsigned char* subQueueAddr = addr + controlSize + subQueueSize * index;
+        int numaNode = (mNumaNodes.empty() ? -1 : mNumaNodes[index].node);
+        if(numaNode >= 0 && !ProcessAffinity::BindMemory(subQueueAddr, subQueueSize, numaNode))
+        {
+            std::string errmsg = strerror(errno);
+            PROCESS_POOL_INFO("Request Queue memory isn't bound to NUMA node " << numaNode << " because " << errmsg);
+        }
+
+        SubQueue* subQueue = new (subQueueAddr) SubQueue;
+        subQueue->numaNode = numaNode;
+        subQueue->tenants = (TenantQueue*)(subQueueAddr + sizeof(SubQueue));
+        RequestList* lists = (RequestList*)(subQueue->tenants + mTenantCount);
+        for(unsigned int tenant = 0; tenant < mTenantCount; tenant++)
+        {
+            new (&subQueue->tenants[tenant]) TenantQueue;
+            subQueue->tenants[tenant].lists = lists + tenant * mCostGroups;
+            for(unsigned int group = 0; group < mCostGroups; group++)
+                new (&subQueue->tenants[tenant].lists[group]) RequestList;
+        }
+
+        // Set next available address for a new allocation
+        subQueue->fillPtr = subQueueAddr + sizeof(SubQueue) + tenantQueuesSize;
+        subQueue->endPtr = subQueueAddr + subQueueSize;
+        mSubQueues.push_back(subQueue);
+    }
+
+    // Note: Not logged by the constructor, a subclass' OnInfo() isn't there yet
+    PROCESS_POOL_INFO("Request Queue holds up to " << maxRequestCount << " requests in "
+                      << subQueueCount << " sub-queue(s)");
+    return true;
+}
+
+// Request Queue size, AUTO_REQUEST_COUNT is resolved by the current memory limit
+template<class ARGS>
+unsigned int ProcessQueue<ARGS>::GetMaxRequestCount() const
+{
+    if(mMaxRequestCount == AUTO_REQUEST_COUNT)
+        return ProcessLimits::GetRequestCount(sizeof(Node));
+    return mMaxRequestCount;
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::DeleteRequestQueue()
+{
+    assert(IsParent());
+
+    if(mRequestQueue)
+    {
+        if(::munmap(mRequestQueue, mRequestQueueSize) < 0)
+        {
+            std::string errmsg = strerror(errno);
+            PROCESS_POOL_ERROR("munmap failed with error \"" << errmsg << "\"");
+        }
+    }
+
+    mRequestQueue = nullptr;
+    mChildInfo = nullptr;
+    mTenantInfo = nullptr;
+    mTypeCosts = nullptr;
+    mSubQueues.clear();
+    mRequestQueueSize = 0;
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::WaitForCompletion()
+{
+    assert(IsParent());
+
+    // Loop until no request left in Request Queue
+    bool keepWaiting = true;
+    for(useconds_t delay = 10000 /*10 ms*/; keepWaiting; usleep(delay))
+    {
+        // Check for any crash children
+        if(HasCrashedChildren())
+        {
+            // TODO: What should we do if we have a crashed child?
+        }
+
+        // Send statistics notification if it's time to
+        CheckStatsTimer();
+
+        // Pass children log messages and output, etc.
+        PollChildren();
+
+        // Once every sub-queue is empty, reset hasMore flag.
+        // Note: Children only take requests, so an empty sub-queue stays empty
+        bool isEmpty = true;
+        for(SubQueue* subQueue : mSubQueues)
+        {
+            QueueLock lock(subQueue->lock, &mParentStats);
+            if(!lock)
+            {
+                PROCESS_POOL_ERROR("Failed to obtain Request Queue lock");
+                return false;
+            }
+
+            if(subQueue->depth)
+            {
+                isEmpty = false;
+                break;
+            }
+        }
+
+        if(isEmpty)
+            mRequestQueue->hasMore = false;
+
+        // Note: we no longer need QueueLock
+        if(!mRequestQueue->hasMore)
+        {
+            // Wait for child processes to complete.
+            // Note: Check twice, a hedging child clears its flag before the child it copies
+            // can set its own, but a child checked first may have been read before that.
+            keepWaiting = false;    // Assuming all processes are done
+            size_t childrenCount = mChildrenPIDs.size();
+            for(int pass = 0; pass < 2 && !keepWaiting; pass++)
+            {
+                for(size_t childIndex = 0; childIndex < childrenCount; childIndex++)
+                {
+                    if(__atomic_load_n(&mIsChildDone[childIndex], __ATOMIC_ACQUIRE) == 0)
+                    {
+                        // Got child process that is still busy...keep waiting
+                        keepWaiting = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Keep statistics of this batch
+    ProcessQueueStats stats;
+    if(Snapshot(stats))
+    {
+        mBatchStats = stats;
+        mBatchStats.Sub(mCompletionStats);
+        mCompletionStats = stats;
+    }
 
     // All child processes completed. Reset for another run.
     mRequestQueue->hasMore = true;
@@ -377,6 +1714,8 @@ void ProcessQueue<ARGS>::Destroy()
         mRequestQueue->stop = true;
         WaitForAll();
         DeleteRequestQueue();
+        DrainOutput(true);
+        UnpinParent();
     }
 }
 
@@ -408,6 +1747,11 @@ bool ProcessQueue<ARGS>::HasCrashedChildren()
 
         // The child has crashed
         PROCESS_POOL_ERROR("Child " << childIndex << " (" << childPID << ") has crashed");
+        mRequestQueue->crashes++;
+        PROCESS_POOL_PROBE2(child_crash, childIndex, childPID);
+
+        // Note: The crashed child no longer writes into its trace buffer
+        mTrace.Record(childIndex, ProcessTrace::EVENT::CRASH, childIndex);
 
         // TODO: Should we have a different CHILD_STATUS for a crashed child?
         mChildrenPIDs[childIndex].status = CHILD_STATUS::DONE;
@@ -417,5 +1761,296 @@ bool ProcessQueue<ARGS>::HasCrashedChildren()
     return (childPID != 0);
 }
 
+template<class ARGS>
+bool ProcessQueue<ARGS>::Snapshot(ProcessQueueStats& stats)
+{
+    assert(IsParent());
+
+    if(!mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        return false;
+    }
+
+    // Note: Queue counters are updated under lock, but we don't need
+    // them to be consistent with each other so read them lock-free
+    stats.posted = __atomic_load_n(&mRequestQueue->posted, __ATOMIC_RELAXED);
+    stats.postFailures = __atomic_load_n(&mRequestQueue->postFailures, __ATOMIC_RELAXED);
+    stats.shed = __atomic_load_n(&mRequestQueue->shed, __ATOMIC_RELAXED);
+    stats.queueDepth = __atomic_load_n(&mRequestQueue->depth, __ATOMIC_RELAXED);
+    stats.maxQueueDepth = __atomic_load_n(&mRequestQueue->maxDepth, __ATOMIC_RELAXED);
+    stats.crashes = __atomic_load_n(&mRequestQueue->crashes, __ATOMIC_RELAXED);
+    stats.parent = mParentStats.stats;
+    stats.memory.resize(mChildrenPIDs.size());
+
+    size_t childrenCount = mChildrenPIDs.size();
+    stats.children.resize(childrenCount);
+    stats.total = ProcessChildStats();
+
+    for(size_t childIndex = 0; childIndex < childrenCount; childIndex++)
+    {
+        // Note: A child killed while updating its counters leaves them as they are
+        mChildInfo[childIndex].stats.Read(stats.children[childIndex]);
+        stats.memory[childIndex] = mChildrenPIDs[childIndex].memory;
+        stats.total.Add(stats.children[childIndex]);
+    }
+
+    stats.tenants.resize(mTenantCount);
+    for(unsigned int tenant = 0; tenant < mTenantCount; tenant++)
+    {
+        stats.tenants[tenant].posted = __atomic_load_n(&mTenantInfo[tenant].posted, __ATOMIC_RELAXED);
+        stats.tenants[tenant].completed = __atomic_load_n(&mTenantInfo[tenant].completed, __ATOMIC_RELAXED);
+        stats.tenants[tenant].running = __atomic_load_n(&mTenantInfo[tenant].running, __ATOMIC_RELAXED);
+    }
+
+    return true;
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::EnableTracing(unsigned int eventsPerChild /*= 65536*/, unsigned int sampleRate /*= 1*/)
+{
+    assert(IsParent());
+
+    if(mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Tracing must be enabled before Create()");
+        return false;
+    }
+
+    mTraceEvents = eventsPerChild;
+    mTraceSampleRate = (eventsPerChild ? sampleRate : 0);
+    return true;
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::WriteTrace(const std::string& path)
+{
+    assert(IsParent());
+    return mTrace.Write(path);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::GetLatency(ProcessQueueLatency& latency)
+{
+    assert(IsParent());
+
+    if(!mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Request Queue is not created");
+        return false;
+    }
+
+    latency.queueWait.Reset();
+    latency.service.Reset();
+    latency.endToEnd.Reset();
+
+    size_t childrenCount = mChildrenPIDs.size();
+    for(size_t childIndex = 0; childIndex < childrenCount; childIndex++)
+    {
+        const ProcessQueueLatency& childLatency = mChildInfo[childIndex].latency;
+        latency.queueWait.Add(childLatency.queueWait);
+        latency.service.Add(childLatency.service);
+        latency.endToEnd.Add(childLatency.endToEnd);
+    }
+
+    return true;
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::PublishPerfCounters(ProcessStatsSection& stats)
+{
+    ProcessChildStats values;
+    mPerfCounters.Read(values);
+
+    stats.BeginUpdate();
+    ProcessStatsSection::Set(stats.stats.taskClockNs, values.taskClockNs);
+    ProcessStatsSection::Set(stats.stats.contextSwitches, values.contextSwitches);
+    ProcessStatsSection::Set(stats.stats.pageFaults, values.pageFaults);
+    ProcessStatsSection::Set(stats.stats.cycles, values.cycles);
+    ProcessStatsSection::Set(stats.stats.instructions, values.instructions);
+    stats.EndUpdate();
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::SetDequeueBatch(unsigned int count)
+{
+    assert(IsParent());
+
+    mDequeueBatch = (count > 0 ? count : 1);
+    if(mRequestQueue)
+        __atomic_store_n(&mRequestQueue->dequeueBatch, mDequeueBatch, __ATOMIC_RELAXED);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::Tune(const std::vector<ARGS>& calibration, void (*fptr)(const ARGS&),
+                              ProcessTuneResult& best, bool apply /*= true*/, int maxProcCount /*= 0*/,
+                              void (*broadcastFptr)(const ARGS&) /*= nullptr*/)
+{
+    assert(IsParent());
+
+    if(mRequestQueue)
+    {
+        PROCESS_POOL_ERROR("Tune() must be called before Create()");
+        return false;
+    }
+
+    unsigned int maxRequestCount = GetMaxRequestCount();
+    if(calibration.empty() || calibration.size() > maxRequestCount)
+    {
+        PROCESS_POOL_ERROR("Invalid (" << calibration.size() << ") calibration size, Request Queue holds up to "
+                           << maxRequestCount << " requests");
+        return false;
+    }
+
+    // More children than CPUs available to us only add context switches
+    int cpuLimit = ProcessLimits::GetCpuLimit();
+    if(maxProcCount <= 0 || maxProcCount > cpuLimit)
+        maxProcCount = cpuLimit;
+
+    const unsigned int MAX_DEQUEUE_BATCH = 64;
+    mTuneResults.clear();
+    unsigned int dequeueBatch = mDequeueBatch;
+
+    // Double the number of children up to (and including) the maximum
+    for(int procCount = 1; ; procCount = std::min(procCount * 2, maxProcCount))
+    {
+        if(!Create(procCount, fptr, broadcastFptr))
+            return false;
+
+        // Warm up children and the queue memory
+        for(const ARGS& args : calibration)
+            Post(args);
+        WaitForCompletion();
+
+        // Every child should get something to do
+        for(unsigned int batch = 1; batch <= MAX_DEQUEUE_BATCH && batch * procCount <= calibration.size(); batch *= 2)
+        {
+            SetDequeueBatch(batch);
+
+            ProcessQueueLatency startLatency, latency;
+            GetLatency(startLatency);
+            uint64_t startNs = GetMonotonicTimeNs();
+
+            for(const ARGS& args : calibration)
+                Post(args);
+            WaitForCompletion();
+
+            uint64_t elapsedNs = GetMonotonicTimeNs() - startNs;
+            GetLatency(latency);
+            latency.endToEnd.Sub(startLatency.endToEnd);
+
+            ProcessTuneResult result;
+            result.procCount = procCount;
+            result.dequeueBatch = batch;
+            result.requestsPerSec = calibration.size() * 1e9 / (elapsedNs ? elapsedNs : 1);
+            result.p99Ns = latency.endToEnd.GetPercentile(99);
+            mTuneResults.push_back(result);
+
+            PROCESS_POOL_INFO(procCount << " children, dequeue batch " << batch << ": "
+                              << (uint64_t)result.requestsPerSec << " requests/sec, p99 " << result.p99Ns / 1000 << " us");
+        }
+
+        Destroy();
+
+        if(procCount == maxProcCount)
+            break;
+    }
+
+    // The fastest configuration, or a configuration with better latency that is almost as fast
+    double maxRequestsPerSec = 0;
+    for(const ProcessTuneResult& result : mTuneResults)
+        maxRequestsPerSec = std::max(maxRequestsPerSec, result.requestsPerSec);
+
+    best = ProcessTuneResult();
+    for(const ProcessTuneResult& result : mTuneResults)
+    {
+        if(result.requestsPerSec >= maxRequestsPerSec * 0.95 && (best.procCount == 0 || result.p99Ns < best.p99Ns))
+            best = result;
+    }
+
+    PROCESS_POOL_INFO("best configuration is " << best.procCount << " children, dequeue batch "
+                      << best.dequeueBatch << " out of " << mTuneResults.size());
+
+    if(!apply)
+    {
+        mDequeueBatch = dequeueBatch;
+        return true;
+    }
+
+    SetDequeueBatch(best.dequeueBatch);
+    return Create(best.procCount, fptr, broadcastFptr);
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::StartCapture(const std::string& path)
+{
+    static_assert(std::is_trivially_copyable<ARGS>::value, "Captured requests must be trivially copyable");
+    assert(IsParent());
+
+    return mCapture.Create(path, sizeof(ARGS));
+}
+
+template<class ARGS>
+bool ProcessQueue<ARGS>::Replay(const std::string& path, double speed /*= 1.0*/)
+{
+    static_assert(std::is_trivially_copyable<ARGS>::value, "Captured requests must be trivially copyable");
+    assert(IsParent());
+
+    ProcessCapture capture;
+    if(!capture.Open(path, sizeof(ARGS)))
+        return false;
+
+    ARGS args;
+    ProcessCapture::Record record;
+    uint64_t startNs = GetMonotonicTimeNs();
+    uint64_t maxLagNs = 0;
+    bool result = true;
+
+    while(capture.Read(record, &args, sizeof(ARGS)))
+    {
+        // Wait until the request is due at the replay speed
+        if(speed > 0)
+        {
+            uint64_t dueNs = startNs + (uint64_t)(record.offsetNs / speed);
+            uint64_t nowNs = GetMonotonicTimeNs();
+            if(dueNs > nowNs)
+                usleep((useconds_t)((dueNs - nowNs) / 1000));
+            else if(nowNs - dueNs > maxLagNs)
+                maxLagNs = nowNs - dueNs;
+        }
+
+        bool isPosted;
+        if(record.numaNode >= 0)
+            isPosted = PostToNode(args, record.numaNode, record.cost);
+        else if(record.tenant != 0)
+            isPosted = PostToTenant(args, record.tenant, record.cost);
+        else if(record.cost != 0)
+            isPosted = Post(args, record.cost);
+        else
+            isPosted = Post(args);
+
+        if(!isPosted)
+            result = false;
+    }
+
+    PROCESS_POOL_INFO("Replayed " << capture.GetCount() << " requests from '" << path << "' in "
+                      << (GetMonotonicTimeNs() - startNs) / 1000000 << " ms, max lag " << maxLagNs / 1000 << " us");
+
+    return (WaitForCompletion() && result);
+}
+
+template<class ARGS>
+void ProcessQueue<ARGS>::CheckStatsTimer()
+{
+    if(mStatsIntervalNs == 0)
+        return; // Statistics notification is disabled
+
+    uint64_t nowNs = GetMonotonicTimeNs();
+    if(nowNs - mStatsTimerNs < mStatsIntervalNs)
+        return; // Not a good time to notify
+
+    mStatsTimerNs = nowNs;
+    OnNotify(NOTIFY_TYPE::STATS);
+}
 
 #endif // _PROCESS_QUEUE_HPP_
@@ -0,0 +1,289 @@
+//
+// processRcu.hpp
+//
+#ifndef _PROCESS_RCU_HPP_
+#define _PROCESS_RCU_HPP_
+
+#include <stdint.h>         // uint32_t, uint64_t
+#include <assert.h>         // assert()
+#include <unistd.h>         // usleep(), getpid()
+#include <sys/mman.h>       // mmap()
+#include <type_traits>      // std::is_trivially_copyable
+#include "processPool.hpp"
+
+//
+// Base class for shared data that children pick up at request boundaries
+// (see ProcessQueue::AddRcu())
+//
+class ProcessRcuBase : public ProcessLogger
+{
+public:
+    virtual ~ProcessRcuBase() = default;
+
+    // Called by a child when it doesn't hold any reference to the shared data
+    virtual void Quiesce(int childIndex) = 0;
+
+    // Number of children (0 - readerCount-1) that may read the shared data
+    virtual int GetReaderCount() const = 0;
+};
+
+//
+// Read-mostly data shared between the parent and children processes (RCU).
+// The parent publishes a new version of the data into shared memory without
+// restarting children. Every child keeps using the version it has picked up
+// until it calls Quiesce() at the next request boundary. The old version is
+// reused for a new publication once no child refers to it anymore.
+// Note: The data is copied into shared memory, so it must be trivially
+// copyable (no pointers to the parent's private memory).
+//
+template<class DATA>
+class ProcessRcu : public ProcessRcuBase
+{
+    static_assert(std::is_trivially_copyable<DATA>::value, "ProcessRcu data must be trivially copyable");
+
+public:
+    // Note: versionCount is the number of data copies kept in shared memory.
+    // With more versions the parent is less likely to wait for a slow child
+    // to move on before it can publish.
+    ProcessRcu(unsigned int versionCount = 3) : mVersionCount(versionCount < 2 ? 2 : versionCount) {}
+    virtual ~ProcessRcu() { Delete(); }
+
+    // Omit implementation of the copy constructor and assignment operator
+    ProcessRcu(const ProcessRcu&) = delete;
+    ProcessRcu& operator=(const ProcessRcu&) = delete;
+
+    // Create shared data for readerCount children and publish its first version.
+    // Must be called by the parent before forking children.
+    bool Create(int readerCount, const DATA& data);
+
+    // Publish a new version of the data (parent only).
+    // Wait up to waitMilliseconds for children to release an old version.
+    bool Publish(const DATA& data, int waitMilliseconds = 5000);
+
+    // Pick up the latest version of the data (child only)
+    void Quiesce(int childIndex) override;
+
+    int GetReaderCount() const override { return mReaderCount; }
+
+    // Get the version of the data picked up by the last Quiesce() call in a child,
+    // or the latest published version in the parent
+    const DATA& Get() const;
+    uint64_t GetVersion() const;
+
+private:
+    void Delete();
+
+    // Shared memory layout: Header, pins[readerCount], slots[versionCount]
+    struct Header
+    {
+        uint32_t current{0};        // Slot holding the latest version
+        uint64_t version{0};        // Latest version number
+    };
+
+    static const uint32_t NOT_PINNED = UINT32_MAX;
+
+    unsigned int mVersionCount{0};
+    int mReaderCount{0};
+    pid_t mCreatorPID{0};
+
+    Header* mHeader{nullptr};
+    uint32_t* mPins{nullptr};       // Slot each child refers to
+    uint64_t* mSlotVersions{nullptr};
+    DATA* mSlots{nullptr};
+    size_t mSize{0};
+
+    // Slot picked up by this (child) process
+    uint32_t mPinnedSlot{NOT_PINNED};
+    bool mIsOutOfRange{false};      // The child has no reader slot (reported once)
+};
+
+template<class DATA>
+bool ProcessRcu<DATA>::Create(int readerCount, const DATA& data)
+{
+    Delete();
+
+    if(readerCount <= 0)
+    {
+        PROCESS_POOL_ERROR("Invalid (" << readerCount << ") reader count");
+        return false;
+    }
+
+    // Keep the data slots aligned for DATA
+    size_t headerSize = sizeof(Header) + sizeof(uint32_t) * readerCount + sizeof(uint64_t) * mVersionCount;
+    size_t align = alignof(DATA) > alignof(uint64_t) ? alignof(DATA) : alignof(uint64_t);
+    headerSize = (headerSize + align - 1) / align * align;
+    size_t len = headerSize + sizeof(DATA) * mVersionCount;
+
+    unsigned char* addr = (unsigned char*)::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if(addr == MAP_FAILED)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("mmap for " << len << " bytes failed with error \"" << errmsg << "\"");
+        return false;
+    }
+
+    mHeader = new (addr) Header;
+    mPins = (uint32_t*)(addr + sizeof(Header));
+    mSlotVersions = (uint64_t*)(mPins + readerCount);
+    mSlots = (DATA*)(addr + headerSize);
+    mSize = len;
+    mReaderCount = readerCount;
+    mCreatorPID = getpid();
+
+    for(int i = 0; i < readerCount; i++)
+        mPins[i] = NOT_PINNED;
+
+    // Publish the very first version
+    mSlots[0] = data;
+    mSlotVersions[0] = mHeader->version = 1;
+    mHeader->current = 0;
+    return true;
+}
+
+template<class DATA>
+bool ProcessRcu<DATA>::Publish(const DATA& data, int waitMilliseconds /*= 5000*/)
+{
+    if(!mHeader)
+    {
+        PROCESS_POOL_ERROR("Shared data is not created");
+        return false;
+    }
+
+    if(getpid() != mCreatorPID)
+    {
+        PROCESS_POOL_ERROR("This method is not allowed in the child process");
+        return false;
+    }
+
+    // Find a slot that is neither the latest version nor used by any child.
+    // Note: A child publishes its pin before re-checking the latest version,
+    // so a slot that isn't pinned here can't be picked up until we switch to it.
+    const int SLEEP_MICROSEC = 1000;   // 1 ms
+    int waitUseconds = waitMilliseconds * 1000;
+    uint32_t current = mHeader->current;
+    uint32_t freeSlot = NOT_PINNED;
+
+    while(true)
+    {
+        for(uint32_t slot = 0; slot < mVersionCount && freeSlot == NOT_PINNED; slot++)
+        {
+            if(slot == current)
+                continue;
+
+            freeSlot = slot;
+            for(int i = 0; i < mReaderCount; i++)
+            {
+                if(__atomic_load_n(&mPins[i], __ATOMIC_SEQ_CST) == slot)
+                {
+                    freeSlot = NOT_PINNED; // Some child still refers to this slot
+                    break;
+                }
+            }
+        }
+
+        if(freeSlot != NOT_PINNED)
+            break;
+
+        if(waitUseconds <= 0)
+        {
+            PROCESS_POOL_ERROR("All " << mVersionCount << " versions are still in use by children");
+            return false;
+        }
+
+        usleep(SLEEP_MICROSEC); // Wait for children to move on
+        waitUseconds -= SLEEP_MICROSEC;
+    }
+
+    // Copy the data and switch children to the new version
+    mSlots[freeSlot] = data;
+    mSlotVersions[freeSlot] = mHeader->version + 1;
+    __atomic_store_n(&mHeader->version, mHeader->version + 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&mHeader->current, freeSlot, __ATOMIC_SEQ_CST);
+
+    PROCESS_POOL_INFO("Published version " << mSlotVersions[freeSlot] << " in slot " << freeSlot);
+    return true;
+}
+
+template<class DATA>
+void ProcessRcu<DATA>::Quiesce(int childIndex)
+{
+    if(!mHeader)
+        return;
+
+    // Note: Without its own pin the child would read a version the parent may overwrite
+    if(childIndex < 0 || childIndex >= mReaderCount)
+    {
+        if(!mIsOutOfRange)
+        {
+            PROCESS_POOL_ERROR("Child " << childIndex << " can't read shared data created for " << mReaderCount << " readers");
+            mIsOutOfRange = true;
+        }
+        return;
+    }
+
+    // Pin the latest version and make sure it's still the latest one
+    // after the pin became visible to the parent
+    uint32_t* pin = &mPins[childIndex];
+    uint32_t slot = __atomic_load_n(&mHeader->current, __ATOMIC_SEQ_CST);
+
+    while(true)
+    {
+        __atomic_store_n(pin, slot, __ATOMIC_SEQ_CST);
+
+        uint32_t current = __atomic_load_n(&mHeader->current, __ATOMIC_SEQ_CST);
+        if(current == slot)
+            break;
+
+        slot = current; // The parent has just published a new version
+    }
+
+    mPinnedSlot = slot;
+}
+
+template<class DATA>
+const DATA& ProcessRcu<DATA>::Get() const
+{
+    assert(mHeader);
+
+    // The parent always sees the latest version
+    if(mPinnedSlot == NOT_PINNED)
+    {
+        assert(getpid() == mCreatorPID);
+        return mSlots[mHeader->current];
+    }
+
+    return mSlots[mPinnedSlot];
+}
+
+template<class DATA>
+uint64_t ProcessRcu<DATA>::GetVersion() const
+{
+    assert(mHeader);
+    return mSlotVersions[mPinnedSlot == NOT_PINNED ? mHeader->current : mPinnedSlot];
+}
+
+template<class DATA>
+void ProcessRcu<DATA>::Delete()
+{
+    if(mHeader && getpid() == mCreatorPID)
+    {
+        if(::munmap(mHeader, mSize) < 0)
+        {
+            std::string errmsg = strerror(errno);
+            PROCESS_POOL_ERROR("munmap failed with error \"" << errmsg << "\"");
+        }
+    }
+
+    mHeader = nullptr;
+    mPins = nullptr;
+    mSlotVersions = nullptr;
+    mSlots = nullptr;
+    mSize = 0;
+    mReaderCount = 0;
+    mPinnedSlot = NOT_PINNED;
+    mIsOutOfRange = false;
+}
+
+#endif // _PROCESS_RCU_HPP_
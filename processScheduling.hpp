@@ -0,0 +1,113 @@
+//
+// processScheduling.hpp
+//
+#ifndef _PROCESS_SCHEDULING_HPP_
+#define _PROCESS_SCHEDULING_HPP_
+
+#include <errno.h>          // errno
+#include <limits.h>         // INT_MIN
+#include <string.h>         // strerror()
+#include <sched.h>          // sched_setscheduler()
+#include <unistd.h>         // syscall()
+#include <sys/mman.h>       // mlockall()
+#include <sys/resource.h>   // setpriority()
+#include <sys/syscall.h>    // SYS_ioprio_set
+#include <string>           // std::string
+
+//
+// CPU and I/O scheduling of a child process (see ProcessPool::SetScheduling()).
+// Default settings keep the scheduling inherited from the parent.
+// Note: Raising priority (negative nice, realtime policy or I/O class) and
+// locking memory need CAP_SYS_NICE, CAP_SYS_ADMIN, CAP_IPC_LOCK or rlimits.
+//
+struct ProcessScheduling
+{
+    // CPU scheduling policy
+    enum class POLICY : char
+    {
+        INHERIT=1,      // Keep the parent's policy
+        OTHER,          // SCHED_OTHER: default time sharing
+        BATCH,          // SCHED_BATCH: CPU-bound background work, fewer preemptions
+        IDLE,           // SCHED_IDLE: runs only when nothing else wants the CPU
+        FIFO            // SCHED_FIFO: realtime, runs until it blocks or a higher priority task wakes up
+    };
+
+    // I/O scheduling class (honored by BFQ and CFQ I/O schedulers)
+    enum class IO_CLASS : char
+    {
+        INHERIT=1,      // Keep the parent's I/O priority
+        REALTIME,       // Served first, ioLevel 0 (highest) - 7
+        BEST_EFFORT,    // Default, ioLevel 0 (highest) - 7
+        IDLE            // Served only when nobody else uses the disk
+    };
+
+    static const int INHERIT_NICE = INT_MIN;
+
+    int nice{INHERIT_NICE};         // -20 (highest priority) - 19 (lowest), ignored by IDLE and FIFO
+    POLICY policy{POLICY::INHERIT};
+    int priority{1};                // Static priority of FIFO: 1 (lowest) - 99
+    bool lockMemory{false};         // mlockall() to avoid page faults, e.g. with FIFO.
+                                    // Note: It breaks copy-on-write sharing of all writable
+                                    // pages inherited from the parent.
+    IO_CLASS ioClass{IO_CLASS::INHERIT};
+    int ioLevel{4};
+
+    // Are settings different from the inherited ones?
+    bool IsSet() const
+    {
+        return (nice != INHERIT_NICE || policy != POLICY::INHERIT || lockMemory || ioClass != IO_CLASS::INHERIT);
+    }
+
+    // Apply settings to the calling process. Every setting is applied even if another one fails.
+    // Returns false with all failures in error.
+    bool Apply(std::string& error) const;
+};
+
+//
+// ProcessScheduling class implementation
+//
+inline bool ProcessScheduling::Apply(std::string& error) const
+{
+    error.clear();
+    auto addError = [&error](const std::string& msg) { error += (error.empty() ? "" : ", ") + msg; };
+
+    // Note: The policy goes first since it resets the nice value of IDLE
+    if(policy != POLICY::INHERIT)
+    {
+        struct sched_param param{};
+        int schedPolicy = SCHED_OTHER;
+        if(policy == POLICY::BATCH)
+            schedPolicy = SCHED_BATCH;
+        else if(policy == POLICY::IDLE)
+            schedPolicy = SCHED_IDLE;
+        else if(policy == POLICY::FIFO)
+        {
+            schedPolicy = SCHED_FIFO;
+            param.sched_priority = priority;
+        }
+
+        if(sched_setscheduler(0, schedPolicy, &param) != 0)
+            addError(std::string("sched_setscheduler() failed: ") + strerror(errno));
+    }
+
+    if(nice != INHERIT_NICE && setpriority(PRIO_PROCESS, 0, nice) != 0)
+        addError(std::string("setpriority(") + std::to_string(nice) + ") failed: " + strerror(errno));
+
+    if(ioClass != IO_CLASS::INHERIT)
+    {
+        // See linux/ioprio.h
+        const int IOPRIO_WHO_PROCESS = 1;
+        const int IOPRIO_CLASS_SHIFT = 13;
+        int ioprioClass = (ioClass == IO_CLASS::REALTIME ? 1 : ioClass == IO_CLASS::BEST_EFFORT ? 2 : 3);
+        int ioprio = (ioprioClass << IOPRIO_CLASS_SHIFT) | (ioClass == IO_CLASS::IDLE ? 0 : ioLevel);
+        if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0)
+            addError(std::string("ioprio_set() failed: ") + strerror(errno));
+    }
+
+    if(lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        addError(std::string("mlockall() failed: ") + strerror(errno));
+
+    return error.empty();
+}
+
+#endif // _PROCESS_SCHEDULING_HPP_
@@ -0,0 +1,370 @@
+//
+// processStats.hpp
+//
+#ifndef _PROCESS_STATS_HPP_
+#define _PROCESS_STATS_HPP_
+
+#include <stdint.h>         // uint64_t, UINT64_MAX
+#include <time.h>           // clock_gettime()
+#include <sched.h>          // sched_yield()
+#include <vector>           // std::vector
+
+// Monotonic time in nanoseconds
+inline uint64_t GetMonotonicTimeNs()
+{
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//
+// Child process counters.
+// Note: Children update their own counters in shared memory with relaxed
+// atomics, the parent reads them with a seqlock (see ProcessStatsSection).
+//
+struct ProcessChildStats
+{
+    uint64_t requests{0};       // Requests processed
+    uint64_t broadcasts{0};     // Broadcast messages processed
+    uint64_t stolen{0};         // Requests taken from other NUMA nodes (see ProcessQueue::EnableNuma())
+    uint64_t hedged{0};         // Duplicates of straggling requests run (see ProcessQueue::SetHedging())
+    uint64_t hedgeWins{0};      // Duplicates that finished first
+    uint64_t busyNs{0};         // Time spent processing requests
+    uint64_t idleNs{0};         // Time spent waiting for requests
+    uint64_t lockWaitNs{0};     // Time spent waiting for the Request Queue lock
+    uint64_t lockContended{0};  // Lock acquisitions that had to wait
+    uint64_t lockFailures{0};   // Lock acquisitions that timed out
+
+    // Perf counters (see ProcessQueue::EnablePerfCounters())
+    uint64_t taskClockNs{0};        // CPU time
+    uint64_t contextSwitches{0};
+    uint64_t pageFaults{0};
+    uint64_t cycles{0};             // 0 if there is no PMU (e.g. in a VM)
+    uint64_t instructions{0};       // 0 if there is no PMU (e.g. in a VM)
+
+    // Add counters of another child (to get totals)
+    void Add(const ProcessChildStats& other)
+    {
+        requests += other.requests;
+        broadcasts += other.broadcasts;
+        stolen += other.stolen;
+        hedged += other.hedged;
+        hedgeWins += other.hedgeWins;
+        busyNs += other.busyNs;
+        idleNs += other.idleNs;
+        lockWaitNs += other.lockWaitNs;
+        lockContended += other.lockContended;
+        lockFailures += other.lockFailures;
+        taskClockNs += other.taskClockNs;
+        contextSwitches += other.contextSwitches;
+        pageFaults += other.pageFaults;
+        cycles += other.cycles;
+        instructions += other.instructions;
+    }
+
+    // Subtract earlier counters of the same child (to get the difference)
+    void Sub(const ProcessChildStats& other)
+    {
+        requests -= other.requests;
+        broadcasts -= other.broadcasts;
+        stolen -= other.stolen;
+        hedged -= other.hedged;
+        hedgeWins -= other.hedgeWins;
+        busyNs -= other.busyNs;
+        idleNs -= other.idleNs;
+        lockWaitNs -= other.lockWaitNs;
+        lockContended -= other.lockContended;
+        lockFailures -= other.lockFailures;
+        taskClockNs -= other.taskClockNs;
+        contextSwitches -= other.contextSwitches;
+        pageFaults -= other.pageFaults;
+        cycles -= other.cycles;
+        instructions -= other.instructions;
+    }
+};
+
+//
+// Child process memory footprint (from /proc/<pid>/smaps_rollup).
+// Private pages grow as the child writes into memory shared with the
+// parent on fork (copy-on-write break) or allocates its own memory.
+//
+struct ProcessMemoryUsage
+{
+    uint64_t rss{0};            // Resident memory (bytes)
+    uint64_t pss{0};            // Proportional share of resident memory
+    uint64_t sharedClean{0};
+    uint64_t sharedDirty{0};
+    uint64_t privateClean{0};
+    uint64_t privateDirty{0};
+    uint64_t swap{0};
+    uint64_t sampleTimeNs{0};   // Monotonic time of the sample, 0 if never sampled
+
+    uint64_t GetPrivate() const { return privateClean + privateDirty; }
+};
+
+//
+// Tenant counters (see ProcessQueue::SetTenantCount())
+//
+struct ProcessTenantStats
+{
+    uint64_t posted{0};         // Requests posted
+    uint64_t completed{0};      // Requests processed
+    uint64_t running{0};        // Requests being processed right now
+
+    // Note: The number of running requests is left as is
+    void Sub(const ProcessTenantStats& other)
+    {
+        posted -= other.posted;
+        completed -= other.completed;
+    }
+};
+
+//
+// Process queue statistics snapshot
+//
+struct ProcessQueueStats
+{
+    uint64_t posted{0};         // Requests posted
+    uint64_t postFailures{0};   // Requests failed to post
+    uint64_t shed{0};           // Requests shed under overload (see ProcessQueue::SetShedding())
+    uint64_t queueDepth{0};     // Requests waiting in the queue
+    uint64_t maxQueueDepth{0};  // High watermark of the queue depth
+    uint64_t crashes{0};        // Children detected as crashed
+
+    ProcessChildStats parent;                   // Parent's lock counters
+    ProcessChildStats total;                    // Sum of all children counters
+    std::vector<ProcessChildStats> children;    // Counters per child
+    std::vector<ProcessMemoryUsage> memory;     // Last memory sample per child (see ProcessPool::SetMemoryMonitor())
+    std::vector<ProcessTenantStats> tenants;    // Counters per tenant
+
+    // Subtract earlier snapshot (to get counters of a batch).
+    // Note: Queue depth and its high watermark are left as is.
+    void Sub(const ProcessQueueStats& other)
+    {
+        posted -= other.posted;
+        postFailures -= other.postFailures;
+        shed -= other.shed;
+        crashes -= other.crashes;
+        parent.Sub(other.parent);
+        total.Sub(other.total);
+        for(size_t i = 0; i < children.size() && i < other.children.size(); i++)
+            children[i].Sub(other.children[i]);
+        for(size_t i = 0; i < tenants.size() && i < other.tenants.size(); i++)
+            tenants[i].Sub(other.tenants[i]);
+    }
+};
+
+//
+// Single-writer section of counters protected by a seqlock.
+// Each section occupies its own cache line(s) so children don't
+// invalidate each other's cache lines on the hot path.
+//
+struct alignas(64) ProcessStatsSection
+{
+    uint32_t seq{0};            // Odd while the writer is updating counters
+    ProcessChildStats stats;
+
+    // Writer side: wrap counters updates with BeginUpdate()/EndUpdate()
+    void BeginUpdate()
+    {
+        __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    void EndUpdate()
+    {
+        __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+    }
+
+    static void Add(uint64_t& counter, uint64_t value)
+    {
+        __atomic_store_n(&counter, counter + value, __ATOMIC_RELAXED);
+    }
+
+    static void Set(uint64_t& counter, uint64_t value)
+    {
+        __atomic_store_n(&counter, value, __ATOMIC_RELAXED);
+    }
+
+    // Reader side: get consistent copy of the counters. Returns false if the writer
+    // doesn't finish its update within MAX_READ_RETRIES, e.g. a child has been killed
+    // in the middle of it, then copy has the counters as they are.
+    bool Read(ProcessChildStats& copy) const
+    {
+        for(unsigned int retry = 0; retry < MAX_READ_RETRIES; retry++)
+        {
+            uint32_t seq1 = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+            bool isUpdating = (seq1 & 1); // The writer is updating counters
+
+            copy.requests = __atomic_load_n(&stats.requests, __ATOMIC_RELAXED);
+            copy.broadcasts = __atomic_load_n(&stats.broadcasts, __ATOMIC_RELAXED);
+            copy.stolen = __atomic_load_n(&stats.stolen, __ATOMIC_RELAXED);
+            copy.hedged = __atomic_load_n(&stats.hedged, __ATOMIC_RELAXED);
+            copy.hedgeWins = __atomic_load_n(&stats.hedgeWins, __ATOMIC_RELAXED);
+            copy.busyNs = __atomic_load_n(&stats.busyNs, __ATOMIC_RELAXED);
+            copy.idleNs = __atomic_load_n(&stats.idleNs, __ATOMIC_RELAXED);
+            copy.lockWaitNs = __atomic_load_n(&stats.lockWaitNs, __ATOMIC_RELAXED);
+            copy.lockContended = __atomic_load_n(&stats.lockContended, __ATOMIC_RELAXED);
+            copy.lockFailures = __atomic_load_n(&stats.lockFailures, __ATOMIC_RELAXED);
+            copy.taskClockNs = __atomic_load_n(&stats.taskClockNs, __ATOMIC_RELAXED);
+            copy.contextSwitches = __atomic_load_n(&stats.contextSwitches, __ATOMIC_RELAXED);
+            copy.pageFaults = __atomic_load_n(&stats.pageFaults, __ATOMIC_RELAXED);
+            copy.cycles = __atomic_load_n(&stats.cycles, __ATOMIC_RELAXED);
+            copy.instructions = __atomic_load_n(&stats.instructions, __ATOMIC_RELAXED);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(!isUpdating && __atomic_load_n(&seq, __ATOMIC_RELAXED) == seq1)
+                return true;
+
+            // Let a preempted writer finish its update
+            sched_yield();
+        }
+        return false;
+    }
+
+    static const unsigned int MAX_READ_RETRIES = 1000;
+};
+
+//
+// Log-linear (HDR-style) latency histogram with nanosecond resolution.
+// Values below SUB_BUCKET_COUNT ns are exact, bigger values are grouped
+// into SUB_BUCKET_COUNT buckets per power of two (~3% relative error).
+// Note: A single writer records values with relaxed atomics, so a reader
+// might see a sample in the count but not yet in the bucket.
+//
+struct LatencyHistogram
+{
+    static const unsigned int SUB_BUCKET_BITS = 5;
+    static const unsigned int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const unsigned int MAX_EXPONENT = 43;    // Up to 2^44 ns (~4.9 hours)
+    static const unsigned int BUCKET_COUNT = SUB_BUCKET_COUNT + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    uint64_t count{0};
+    uint64_t sumNs{0};
+    uint64_t minNs{UINT64_MAX};
+    uint64_t maxNs{0};
+    uint64_t buckets[BUCKET_COUNT]{};
+
+    static unsigned int GetBucketIndex(uint64_t valueNs)
+    {
+        if(valueNs < SUB_BUCKET_COUNT)
+            return (unsigned int)valueNs;
+
+        unsigned int exponent = 63 - __builtin_clzll(valueNs);
+        if(exponent > MAX_EXPONENT)
+            return BUCKET_COUNT - 1;
+
+        // Top SUB_BUCKET_BITS bits after the leading one select the sub-bucket
+        unsigned int subBucket = (unsigned int)(valueNs >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT;
+        return SUB_BUCKET_COUNT + (exponent - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT + subBucket;
+    }
+
+    // Highest value that falls into the bucket
+    static uint64_t GetBucketValue(unsigned int index)
+    {
+        if(index < SUB_BUCKET_COUNT)
+            return index;
+
+        unsigned int shift = (index - SUB_BUCKET_COUNT) / SUB_BUCKET_COUNT;
+        uint64_t subBucket = (index - SUB_BUCKET_COUNT) % SUB_BUCKET_COUNT;
+        return ((SUB_BUCKET_COUNT + subBucket + 1) << shift) - 1;
+    }
+
+    // Writer side (single writer)
+    void Record(uint64_t valueNs)
+    {
+        unsigned int index = GetBucketIndex(valueNs);
+        __atomic_store_n(&buckets[index], buckets[index] + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&sumNs, sumNs + valueNs, __ATOMIC_RELAXED);
+        if(valueNs < minNs)
+            __atomic_store_n(&minNs, valueNs, __ATOMIC_RELAXED);
+        if(valueNs > maxNs)
+            __atomic_store_n(&maxNs, valueNs, __ATOMIC_RELAXED);
+        __atomic_store_n(&count, count + 1, __ATOMIC_RELAXED);
+    }
+
+    // Merge histogram of another child (reader side)
+    void Add(const LatencyHistogram& other)
+    {
+        uint64_t otherCount = 0;
+        for(unsigned int i = 0; i < BUCKET_COUNT; i++)
+        {
+            uint64_t value = __atomic_load_n(&other.buckets[i], __ATOMIC_RELAXED);
+            buckets[i] += value;
+            otherCount += value;
+        }
+
+        // Note: Count buckets to stay consistent with a concurrent writer
+        count += otherCount;
+        sumNs += __atomic_load_n(&other.sumNs, __ATOMIC_RELAXED);
+
+        uint64_t otherMin = __atomic_load_n(&other.minNs, __ATOMIC_RELAXED);
+        uint64_t otherMax = __atomic_load_n(&other.maxNs, __ATOMIC_RELAXED);
+        if(otherMin < minNs)
+            minNs = otherMin;
+        if(otherMax > maxNs)
+            maxNs = otherMax;
+    }
+
+    // Remove an earlier snapshot of the same histogram to get the samples recorded since.
+    // Note: Min and max can't be restored, so they stay the overall ones.
+    void Sub(const LatencyHistogram& earlier)
+    {
+        for(unsigned int i = 0; i < BUCKET_COUNT; i++)
+            buckets[i] -= earlier.buckets[i];
+        count -= earlier.count;
+        sumNs -= earlier.sumNs;
+    }
+
+    void Reset() { *this = LatencyHistogram(); }
+
+    // Get value at percentile (0-100), e.g. 99.9
+    uint64_t GetPercentile(double percentile) const
+    {
+        if(count == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+        if(rank < 1)
+            rank = 1;
+
+        uint64_t seen = 0;
+        for(unsigned int i = 0; i < BUCKET_COUNT; i++)
+        {
+            seen += buckets[i];
+            if(seen >= rank)
+            {
+                // Note: The last bucket also takes values above MAX_EXPONENT, so it's bounded by max only
+                if(i == BUCKET_COUNT - 1)
+                    return maxNs;
+                return (GetBucketValue(i) < maxNs ? GetBucketValue(i) : maxNs);
+            }
+        }
+        return maxNs;
+    }
+
+    uint64_t GetMeanNs() const { return (count ? sumNs / count : 0); }
+};
+
+//
+// Process queue latency distributions
+//
+struct ProcessQueueLatency
+{
+    LatencyHistogram queueWait;     // From Post() until a child picked up the request
+    LatencyHistogram service;       // Time spent in the request routine
+    LatencyHistogram endToEnd;      // From Post() until the request routine returned
+};
+
+//
+// Measured configuration of the queue (see ProcessQueue::Tune())
+//
+struct ProcessTuneResult
+{
+    int procCount{0};
+    unsigned int dequeueBatch{0};
+    double requestsPerSec{0};
+    uint64_t p99Ns{0};              // End-to-end latency
+};
+
+#endif // _PROCESS_STATS_HPP_
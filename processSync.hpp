@@ -0,0 +1,331 @@
+//
+// processSync.hpp
+//
+#ifndef _PROCESS_SYNC_HPP_
+#define _PROCESS_SYNC_HPP_
+
+#include <stdint.h>         // uint32_t
+#include <limits.h>         // INT_MAX
+#include <time.h>           // clock_gettime()
+#include <unistd.h>         // syscall(), getpid()
+#include <sys/mman.h>       // mmap()
+#include <sys/syscall.h>    // SYS_futex
+#include <linux/futex.h>    // FUTEX_WAIT, FUTEX_WAKE
+#include "processPool.hpp"
+
+//
+// Base class for futex-based synchronization primitives shared by
+// the parent and children processes. The primitive must be created by
+// the parent before forking children (ProcessPool::Create()), so every
+// child inherits the same shared memory.
+//
+class ProcessSyncBase : public ProcessLogger
+{
+public:
+    ProcessSyncBase() = default;
+    virtual ~ProcessSyncBase() { DeleteShared(); }
+
+    // Omit implementation of the copy constructor and assignment operator
+    ProcessSyncBase(const ProcessSyncBase&) = delete;
+    ProcessSyncBase& operator=(const ProcessSyncBase&) = delete;
+
+protected:
+    bool CreateShared(size_t size);
+    void DeleteShared();
+
+    // Wait while *addr == expected. Negative waitMilliseconds means wait forever.
+    // Returns false if timed out.
+    static bool WaitWhile(uint32_t* addr, uint32_t expected, int waitMilliseconds);
+    static void WakeAll(uint32_t* addr);
+
+    void* mShared{nullptr};
+    size_t mSharedSize{0};
+    pid_t mCreatorPID{0};
+};
+
+//
+// Reusable barrier: every Wait() blocks until count processes call Wait().
+// Note: If Wait() times out, the barrier is broken for the current phase.
+//
+class ProcessBarrier : public ProcessSyncBase
+{
+public:
+    bool Create(int count);
+    bool Wait(int waitMilliseconds = -1);
+
+private:
+    struct Shared
+    {
+        uint32_t arrived{0};    // Number of processes arrived in the current phase
+        uint32_t generation{0}; // Phase number
+        uint32_t count{0};      // Number of processes to wait for
+    };
+};
+
+//
+// Single-use latch: Wait() blocks until the counter goes down to zero
+//
+class ProcessLatch : public ProcessSyncBase
+{
+public:
+    bool Create(int count);
+    void CountDown(int n = 1);
+    bool Wait(int waitMilliseconds = -1);
+    bool ArriveAndWait(int waitMilliseconds = -1) { CountDown(); return Wait(waitMilliseconds); }
+
+private:
+    struct Shared
+    {
+        uint32_t count{0};
+    };
+};
+
+//
+// Manual-reset event: Wait() blocks until the event is set
+//
+class ProcessEvent : public ProcessSyncBase
+{
+public:
+    bool Create(bool isSet = false);
+    void Set();
+    void Reset();
+    bool IsSet() const;
+    bool Wait(int waitMilliseconds = -1);
+
+private:
+    struct Shared
+    {
+        uint32_t isSet{0};
+    };
+};
+
+//
+// ProcessSyncBase class implementation
+//
+inline bool ProcessSyncBase::CreateShared(size_t size)
+{
+    DeleteShared();
+
+    void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("mmap for " << size << " bytes failed with error \"" << errmsg << "\"");
+        return false;
+    }
+
+    mShared = addr;
+    mSharedSize = size;
+    mCreatorPID = getpid();
+    return true;
+}
+
+inline void ProcessSyncBase::DeleteShared()
+{
+    // Note: Children exit with _exit(), but make sure we only unmap in the creator
+    if(mShared && getpid() == mCreatorPID)
+    {
+        if(::munmap(mShared, mSharedSize) < 0)
+        {
+            std::string errmsg = strerror(errno);
+            PROCESS_POOL_ERROR("munmap failed with error \"" << errmsg << "\"");
+        }
+    }
+
+    mShared = nullptr;
+    mSharedSize = 0;
+}
+
+inline bool ProcessSyncBase::WaitWhile(uint32_t* addr, uint32_t expected, int waitMilliseconds)
+{
+    struct timespec deadline{};
+    if(waitMilliseconds >= 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += waitMilliseconds / 1000;
+        deadline.tv_nsec += (waitMilliseconds % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    // Note: Use non-private futex since the word is shared between processes
+    while(__atomic_load_n(addr, __ATOMIC_ACQUIRE) == expected)
+    {
+        struct timespec timeout{};
+        if(waitMilliseconds >= 0)
+        {
+            struct timespec now{};
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long nsec = (deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+            if(nsec <= 0)
+                return false; // Timed out
+
+            timeout.tv_sec = nsec / 1000000000LL;
+            timeout.tv_nsec = nsec % 1000000000LL;
+        }
+
+        syscall(SYS_futex, addr, FUTEX_WAIT, expected, (waitMilliseconds >= 0 ? &timeout : nullptr), nullptr, 0);
+    }
+
+    return true;
+}
+
+inline void ProcessSyncBase::WakeAll(uint32_t* addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+//
+// ProcessBarrier class implementation
+//
+inline bool ProcessBarrier::Create(int count)
+{
+    if(count <= 0)
+    {
+        PROCESS_POOL_ERROR("Invalid (" << count << ") barrier count");
+        return false;
+    }
+
+    if(!CreateShared(sizeof(Shared)))
+        return false;
+
+    Shared* shared = new (mShared) Shared;
+    shared->count = count;
+    return true;
+}
+
+inline bool ProcessBarrier::Wait(int waitMilliseconds /*= -1*/)
+{
+    assert(mShared);
+    Shared* shared = (Shared*)mShared;
+
+    // Note: The phase can't complete before we arrive, so read the generation first
+    uint32_t generation = __atomic_load_n(&shared->generation, __ATOMIC_ACQUIRE);
+
+    if(__atomic_add_fetch(&shared->arrived, 1, __ATOMIC_ACQ_REL) == shared->count)
+    {
+        // The last one to arrive starts the next phase and releases everybody
+        __atomic_store_n(&shared->arrived, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shared->generation, 1, __ATOMIC_RELEASE);
+        WakeAll(&shared->generation);
+        return true;
+    }
+
+    if(!WaitWhile(&shared->generation, generation, waitMilliseconds))
+    {
+        PROCESS_POOL_ERROR("Barrier wait timed out after " << waitMilliseconds << " ms");
+        return false;
+    }
+
+    return true;
+}
+
+//
+// ProcessLatch class implementation
+//
+inline bool ProcessLatch::Create(int count)
+{
+    if(count < 0)
+    {
+        PROCESS_POOL_ERROR("Invalid (" << count << ") latch count");
+        return false;
+    }
+
+    if(!CreateShared(sizeof(Shared)))
+        return false;
+
+    Shared* shared = new (mShared) Shared;
+    shared->count = count;
+    return true;
+}
+
+inline void ProcessLatch::CountDown(int n /*= 1*/)
+{
+    assert(mShared);
+    Shared* shared = (Shared*)mShared;
+
+    uint32_t count = __atomic_load_n(&shared->count, __ATOMIC_RELAXED);
+    uint32_t newCount = 0;
+    do
+    {
+        if(count == 0)
+            return; // Already released
+        newCount = (count > (uint32_t)n ? count - n : 0);
+    }
+    while(!__atomic_compare_exchange_n(&shared->count, &count, newCount, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if(newCount == 0)
+        WakeAll(&shared->count);
+}
+
+inline bool ProcessLatch::Wait(int waitMilliseconds /*= -1*/)
+{
+    assert(mShared);
+    Shared* shared = (Shared*)mShared;
+
+    uint32_t count = 0;
+    while((count = __atomic_load_n(&shared->count, __ATOMIC_ACQUIRE)) != 0)
+    {
+        // Note: We don't restart the timeout if the count changed
+        if(!WaitWhile(&shared->count, count, waitMilliseconds))
+        {
+            PROCESS_POOL_ERROR("Latch wait timed out after " << waitMilliseconds << " ms");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//
+// ProcessEvent class implementation
+//
+inline bool ProcessEvent::Create(bool isSet /*= false*/)
+{
+    if(!CreateShared(sizeof(Shared)))
+        return false;
+
+    Shared* shared = new (mShared) Shared;
+    shared->isSet = (isSet ? 1 : 0);
+    return true;
+}
+
+inline void ProcessEvent::Set()
+{
+    assert(mShared);
+    Shared* shared = (Shared*)mShared;
+
+    __atomic_store_n(&shared->isSet, 1, __ATOMIC_RELEASE);
+    WakeAll(&shared->isSet);
+}
+
+inline void ProcessEvent::Reset()
+{
+    assert(mShared);
+    __atomic_store_n(&((Shared*)mShared)->isSet, 0, __ATOMIC_RELEASE);
+}
+
+inline bool ProcessEvent::IsSet() const
+{
+    assert(mShared);
+    return (__atomic_load_n(&((Shared*)mShared)->isSet, __ATOMIC_ACQUIRE) != 0);
+}
+
+inline bool ProcessEvent::Wait(int waitMilliseconds /*= -1*/)
+{
+    assert(mShared);
+    Shared* shared = (Shared*)mShared;
+
+    if(!WaitWhile(&shared->isSet, 0, waitMilliseconds))
+    {
+        PROCESS_POOL_ERROR("Event wait timed out after " << waitMilliseconds << " ms");
+        return false;
+    }
+
+    return true;
+}
+
+#endif // _PROCESS_SYNC_HPP_
@@ -0,0 +1,260 @@
+//
+// processTrace.hpp
+//
+#ifndef _PROCESS_TRACE_HPP_
+#define _PROCESS_TRACE_HPP_
+
+#include <stdint.h>         // uint64_t
+#include <stdio.h>          // fopen(), fprintf()
+#include <unistd.h>         // getpid()
+#include <sys/mman.h>       // mmap()
+#include "processPool.hpp"
+#include "processStats.hpp" // GetMonotonicTimeNs()
+
+//
+// Trace of the parent and children activity in shared memory.
+// Every process writes into its own ring buffer (single writer, lock-free),
+// the parent merges all buffers into Chrome trace-event JSON file that
+// can be loaded into chrome://tracing or https://ui.perfetto.dev
+//
+class ProcessTrace : public ProcessLogger
+{
+public:
+    enum class EVENT : unsigned char
+    {
+        POST=1,             // Parent posted request
+        DEQUEUE,            // Child picked up request
+        HANDLER_BEGIN,      // Child started request routine
+        HANDLER_END,        // Child completed request routine
+        FORK,               // Child started running
+        EXIT,               // Child is exiting
+        CRASH               // Parent detected that child crashed
+    };
+
+    ProcessTrace() = default;
+    virtual ~ProcessTrace() { Delete(); }
+
+    // Omit implementation of the copy constructor and assignment operator
+    ProcessTrace(const ProcessTrace&) = delete;
+    ProcessTrace& operator=(const ProcessTrace&) = delete;
+
+    // Create bufferCount ring buffers of eventsPerBuffer events each.
+    // Must be called by the parent before forking children.
+    bool Create(unsigned int bufferCount, unsigned int eventsPerBuffer);
+    bool IsCreated() const { return (mBuffers != nullptr); }
+
+    // Assign the buffer to the calling process
+    void Attach(unsigned int bufferIndex, const char* name);
+
+    // Record event. Note: Only one process may write into a buffer.
+    void Record(unsigned int bufferIndex, EVENT event, uint64_t id, uint64_t timeNs = GetMonotonicTimeNs());
+
+    // Merge all buffers into Chrome trace-event JSON file (parent only)
+    bool Write(const std::string& path);
+
+private:
+    void Delete();
+
+    struct Event
+    {
+        uint64_t timeNs{0};
+        uint64_t id{0};
+        EVENT event{EVENT::POST};
+    };
+
+    struct alignas(64) Buffer
+    {
+        uint64_t writeCount{0};     // Total events written (the ring wraps around)
+        pid_t pid{0};
+        char name[32]{};
+    };
+
+    Buffer* GetBuffer(unsigned int bufferIndex) const
+    {
+        return (Buffer*)((unsigned char*)mBuffers + mBufferSize * bufferIndex);
+    }
+
+    Event* GetEvents(Buffer* buffer) const { return (Event*)(buffer + 1); }
+
+    void* mBuffers{nullptr};
+    size_t mSize{0};
+    size_t mBufferSize{0};
+    unsigned int mBufferCount{0};
+    unsigned int mEventsPerBuffer{0};
+    pid_t mCreatorPID{0};
+};
+
+//
+// ProcessTrace class implementation
+//
+inline bool ProcessTrace::Create(unsigned int bufferCount, unsigned int eventsPerBuffer)
+{
+    Delete();
+
+    if(bufferCount == 0 || eventsPerBuffer == 0)
+    {
+        PROCESS_POOL_ERROR("Invalid (" << bufferCount << "x" << eventsPerBuffer << ") trace buffers size");
+        return false;
+    }
+
+    // Keep every buffer aligned to the cache line
+    size_t bufferSize = sizeof(Buffer) + sizeof(Event) * eventsPerBuffer;
+    bufferSize = (bufferSize + alignof(Buffer) - 1) / alignof(Buffer) * alignof(Buffer);
+    size_t len = bufferSize * bufferCount;
+
+    void* addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("mmap for " << len << " bytes failed with error \"" << errmsg << "\"");
+        return false;
+    }
+
+    mBuffers = addr;
+    mSize = len;
+    mBufferSize = bufferSize;
+    mBufferCount = bufferCount;
+    mEventsPerBuffer = eventsPerBuffer;
+    mCreatorPID = getpid();
+
+    for(unsigned int i = 0; i < bufferCount; i++)
+        new (GetBuffer(i)) Buffer;
+
+    return true;
+}
+
+inline void ProcessTrace::Attach(unsigned int bufferIndex, const char* name)
+{
+    if(!mBuffers || bufferIndex >= mBufferCount)
+        return;
+
+    Buffer* buffer = GetBuffer(bufferIndex);
+    buffer->pid = getpid();
+    strncpy(buffer->name, name, sizeof(buffer->name) - 1);
+}
+
+inline void ProcessTrace::Record(unsigned int bufferIndex, EVENT event, uint64_t id,
+                                 uint64_t timeNs /*= GetMonotonicTimeNs()*/)
+{
+    if(!mBuffers || bufferIndex >= mBufferCount)
+        return;
+
+    Buffer* buffer = GetBuffer(bufferIndex);
+    Event& slot = GetEvents(buffer)[buffer->writeCount % mEventsPerBuffer];
+    slot.timeNs = timeNs;
+    slot.id = id;
+    slot.event = event;
+
+    // Publish the event to the reader
+    __atomic_store_n(&buffer->writeCount, buffer->writeCount + 1, __ATOMIC_RELEASE);
+}
+
+inline bool ProcessTrace::Write(const std::string& path)
+{
+    if(!mBuffers)
+    {
+        PROCESS_POOL_ERROR("Trace buffers are not created");
+        return false;
+    }
+
+    FILE* file = fopen(path.c_str(), "w");
+    if(!file)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Can't open trace file '" << path << "' because " << errmsg);
+        return false;
+    }
+
+    // Find the earliest event to make timestamps relative to it
+    uint64_t baseNs = UINT64_MAX;
+    for(unsigned int i = 0; i < mBufferCount; i++)
+    {
+        Buffer* buffer = GetBuffer(i);
+        uint64_t writeCount = __atomic_load_n(&buffer->writeCount, __ATOMIC_ACQUIRE);
+        uint64_t first = (writeCount > mEventsPerBuffer ? writeCount - mEventsPerBuffer : 0);
+        if(writeCount > first && GetEvents(buffer)[first % mEventsPerBuffer].timeNs < baseNs)
+            baseNs = GetEvents(buffer)[first % mEventsPerBuffer].timeNs;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    const char* separator = "";
+
+    for(unsigned int i = 0; i < mBufferCount; i++)
+    {
+        Buffer* buffer = GetBuffer(i);
+        if(buffer->pid == 0)
+            continue; // Never used
+
+        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                separator, buffer->pid, buffer->pid, buffer->name);
+        separator = ",\n";
+
+        // Note: The writer might still be running and overwrite the oldest events
+        uint64_t writeCount = __atomic_load_n(&buffer->writeCount, __ATOMIC_ACQUIRE);
+        uint64_t first = (writeCount > mEventsPerBuffer ? writeCount - mEventsPerBuffer : 0);
+
+        for(uint64_t n = first; n < writeCount; n++)
+        {
+            const Event& event = GetEvents(buffer)[n % mEventsPerBuffer];
+            double ts = (event.timeNs - baseNs) / 1000.0; // Microseconds
+
+            const char* name = "";
+            const char* phase = "i";
+            switch(event.event)
+            {
+            case EVENT::POST:          name = "post"; break;
+            case EVENT::DEQUEUE:       name = "dequeue"; break;
+            case EVENT::HANDLER_BEGIN: name = "request"; phase = "B"; break;
+            case EVENT::HANDLER_END:   name = "request"; phase = "E"; break;
+            case EVENT::FORK:          name = "fork"; break;
+            case EVENT::EXIT:          name = "exit"; break;
+            case EVENT::CRASH:         name = "crash"; break;
+            }
+
+            fprintf(file, "%s{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f%s,\"args\":{\"id\":%llu}}",
+                    separator, phase, name, buffer->pid, buffer->pid, ts,
+                    (phase[0] == 'i' ? ",\"s\":\"t\"" : ""), (unsigned long long)event.id);
+
+            // Connect the request post and dequeue with a flow arrow
+            if(event.event == EVENT::POST || event.event == EVENT::DEQUEUE)
+            {
+                fprintf(file, "%s{\"ph\":\"%s\",\"name\":\"request\",\"cat\":\"request\",\"id\":%llu,"
+                        "\"pid\":%d,\"tid\":%d,\"ts\":%.3f%s}",
+                        separator, (event.event == EVENT::POST ? "s" : "f"), (unsigned long long)event.id,
+                        buffer->pid, buffer->pid, ts, (event.event == EVENT::POST ? "" : ",\"bp\":\"e\""));
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+
+    bool result = (ferror(file) == 0);
+    if(fclose(file) != 0 || !result)
+    {
+        std::string errmsg = strerror(errno);
+        PROCESS_POOL_ERROR("Failed to write trace file '" << path << "' because " << errmsg);
+        return false;
+    }
+
+    return true;
+}
+
+inline void ProcessTrace::Delete()
+{
+    if(mBuffers && getpid() == mCreatorPID)
+    {
+        if(::munmap(mBuffers, mSize) < 0)
+        {
+            std::string errmsg = strerror(errno);
+            PROCESS_POOL_ERROR("munmap failed with error \"" << errmsg << "\"");
+        }
+    }
+
+    mBuffers = nullptr;
+    mSize = 0;
+    mBufferSize = 0;
+    mBufferCount = 0;
+    mEventsPerBuffer = 0;
+}
+
+#endif // _PROCESS_TRACE_HPP_